@@ -18,7 +18,7 @@ use List::Util qw(shuffle min max);
 use Config;
 my $nkilled = 0;
 my $nerror = 0;
-my (@ratios, @runtimes, @basetimes, @alltests);
+my (@ratios, @runtimes, @basetimes, @alltests, @syscalls);
 my %fileinfo;
 sub first (@) { return $_[0]; }
 my $CHECKSUM = first(grep {-x $_} ("/usr/bin/md5sum", "/sbin/md5", "/bin/false"));
@@ -584,6 +584,25 @@ sub enqueue ($$$%) {
 
 my $qitem_last_error;
 
+# Count the system calls in `strace.out`, left by a trial run under STRACE,
+# in total and for the calls that move file data.
+my @IO_SYSCALLS = qw(read pread64 readv preadv write pwrite64 writev pwritev lseek);
+
+sub count_syscalls ($) {
+    my ($t) = @_;
+    my (%calls, $n);
+    open(my $sf, "<", "strace.out") or return;
+    while (<$sf>) {
+        if (/\A(?:\d+\s+)?([a-z_0-9]+)\(/) {
+            $calls{$1} += 1;
+            $n += 1;
+        }
+    }
+    close($sf);
+    $t->{"syscalls"} = $n;
+    $t->{"iosyscalls"} = join(", ", map { "$_ $calls{$_}" } grep { $calls{$_} } @IO_SYSCALLS);
+}
+
 sub run_qitem ($) {
     my ($qitem) = @_;
     my ($maincommand) = $qitem->{"maincommand"};
@@ -630,7 +649,9 @@ sub run_qitem ($) {
                                     "type" => $qitem->{"type"},
                                     "trial" => $qitem->{"count"} + 1},
                        "compare" => $qitem->{"compare"});
-    $t->{"qcommand"} = $qitem->{"command"};
+    # (trials are looked up by their command without any STRACE wrapper)
+    $t->{"qcommand"} = $qitem->{$qitem->{"type"} eq "stdio" ? "stdiocommand" : "maincommand"};
+    count_syscalls($t) if $param{"STRACE"} && $qitem->{"type"} eq "yourcode";
     push @alltests, $t;
 
     $qitem->{"count"} += 1;
@@ -902,6 +923,10 @@ sub run () {
                $tt->{"time"}, $tt->{"utime"}, $tt->{"stime"}, $tt->{"maxrss"} / 1024.0,
                $tt->{"medianof"}, $tt->{"medianof"} == 1 ? "" : "s");
             push @runtimes, $tt->{"time"};
+            if (exists($tt->{"syscalls"})) {
+                printf("SYSCALLS:  %d (%s)\n", $tt->{"syscalls"}, $tt->{"iosyscalls"});
+                push @syscalls, $tt->{"syscalls"};
+            }
         }
 
         # print stdio vs. yourcode comparison
@@ -978,6 +1003,11 @@ sub summary () {
     } elsif (@runtimes) {
         printf "           total time %.3f your code\n", $runtime;
     }
+    if (@syscalls) {
+        my ($nsyscalls) = 0;
+        $nsyscalls += $_ foreach @syscalls;
+        printf "           %d system calls in %s\n", $nsyscalls, pl(scalar(@syscalls), "test");
+    }
 
     if ($VERBOSE || $param{"MAKETRIALLOG"}) {
         my (@testjsons);
@@ -1278,6 +1308,10 @@ enqueue("MSEQ7",
     "./blockcat61 -b 1024 $textmd | cat > outputs/out.txt",
     "mixed-piped medium file, 1KB block I/O, sequential");
 
+enqueue("MSEQ8",
+    "./blockcat61 -b 1048576 -o outputs/out.txt $textmd",
+    "regular medium file, 1MB block I/O, sequential");
+
 
 
 # NONSEQUENTIAL
@@ -1351,6 +1385,24 @@ enqueue("LNONSEQ3",
     "regular large file, 4KB block I/O, random seek order");
 
 
+# STRIDE SWEEP (only when asked for, as in `make check-stride`)
+
+if (grep { ref($_) && $_->[0] eq "STRIDE" } @ALLOW_TESTS) {
+    my $n = 0;
+    foreach my $prog ("stridecat61", "wstridecat61") {
+        my $what = $prog eq "stridecat61" ? "reads" : "writes";
+        foreach my $stride (8192, 65536, 1048576) {
+            foreach my $bs (1, 512, 4096) {
+                ++$n;
+                enqueue("STRIDE$n",
+                    "./$prog -b $bs -t $stride -o outputs/out.bin $binsm",
+                    "regular small binary file, ${bs}B block I/O, ${stride}B stride $what");
+            }
+        }
+    }
+}
+
+
 run();
 
 summary();
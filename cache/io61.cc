@@ -1,36 +1,90 @@
-//MEMORY MAPPING BABY
-
 #include "io61.hh"
 #include <sys/types.h>
 #include <sys/stat.h>
 #include <climits>
 #include <cerrno>
 #include <stdlib.h>
-#include <sys/mman.h>
 #include <sys/stat.h>
 #include <fcntl.h>
 #include <unistd.h>
 #include <stdio.h>
+#include <sys/uio.h>
+#include <algorithm>
 // io61.cc
 //    YOUR CODE HERE!
 
 
+// io61_slot
+//    One block of a read cache. A slot caches file offsets [tag, end_tag);
+//    `tag` is a multiple of the slot size, and the slot holds less than a
+//    full block only at end of file or after a short read.
+
+struct io61_slot {
+    off_t tag = -1;             // file offset of first byte, -1 if unused
+    off_t end_tag = -1;         // file offset one past the last byte
+    unsigned char* buf;         // cached data
+    int next = -1;              // next slot in the same index bucket
+    bool referenced = false;    // CLOCK reference bit
+};
+
+
 // io61_file
 //    Data structure for io61 file wrappers. Add your own stuff.
+//    When reading, [tag, end_tag) is the window of the current slot; a read
+//    outside it looks the block up in `slots`. When writing, it's the
+//    extent being written, which sits in one buffer of `wcap` bytes
+//    starting at file offset `wbase`; `wdirty` holds the buffer's other
+//    extents, if writes have skipped around within it.
 
 struct io61_file {
     int fd = -1;     // file descriptor
     int mode;        // open mode (O_RDONLY or O_WRONLY)
-    static constexpr off_t bufsize = 4096; //blocksize
-    unsigned char cbuf[bufsize]; //buffer for cache
+    bool seekable;   // false for pipes and sockets
+    off_t slotsize; //blocksize, a power of 2
+    unsigned char* cbuf; //buffer for cache (the current slot's)
     off_t tag; //file offset of first byte of cached data
     off_t end_tag; //file offset one past the last byte
     off_t pos_tag; //pos within the cache
-    void* map_addr; //address of map if worked, MAP_FAILED otherwise. 
-    struct stat st; //filesize
+    std::vector<io61_slot> slots; //read cache
+    std::vector<int> index; //tag index: first slot in each bucket, -1 if none
+    size_t hand = 0; //CLOCK hand
+    off_t ra_start; //file offset where the last read from the file started
+    off_t ra_end; //file offset where it ended
+    size_t ra_blocks = 1; //blocks per read: doubles while reads are sequential
+    size_t ra_max; //cap on ra_blocks
+    bool ra_backward = false; //are sequential reads going backward?
+    bool ra_advised = false; //has the kernel been told reads are sequential?
+    off_t st_last = -1; //block of the last strided read (or miss)
+    off_t st_delta = 0; //distance between the last two
+    off_t wbase; //file offset of cbuf[0] when writing
+    off_t wcap; //size of the write buffer
+    bool wbackward = false; //are writes going backward?
+    std::vector<std::pair<off_t, off_t>> wdirty; //other buffered extents
+    off_t fd_pos; //file offset of `fd`
+    unsigned char* slotmem; //memory for all slots
+    unsigned char* scratch = nullptr; //destination for unwanted blocks
 };
 
 
+// Read cache geometry. IO61_SLOTS and IO61_SLOTSIZE in the environment
+// override these; the slot size is rounded up to a power of 2. Sequential
+// reads fill up to half the slots (at most `max_readahead`) at once. Writes
+// go through one buffer of `write_blocks` slots, holding at most
+// `max_extents` separate extents.
+
+static constexpr size_t default_nslots = 64;
+static constexpr size_t default_slotsize = 4096;
+static constexpr size_t max_readahead = 64;
+static constexpr size_t write_blocks = 32;
+static constexpr size_t max_extents = 64;
+
+static size_t cache_param(const char* name, size_t dflt, size_t max) {
+    const char* s = getenv(name);
+    long n = s ? strtol(s, nullptr, 0) : 0;
+    return n > 0 ? std::min((size_t) n, max) : dflt;
+}
+
+
 // io61_fdopen(fd, mode)
 //    Returns a new io61_file for file descriptor `fd`. `mode` is either
 //    O_RDONLY for a read-only file or O_WRONLY for a write-only file.
@@ -41,10 +95,34 @@ io61_file* io61_fdopen(int fd, int mode) {
     io61_file* f = new io61_file;
     f->fd = fd;
     f->mode = mode;
-    f->tag = 0;
-    f->end_tag = 0;
-    f->pos_tag = 0; 
-    f->map_addr = mmap(NULL, f->st.st_size, PROT_READ, MAP_PRIVATE, f->fd, 0);
+    off_t pos = lseek(fd, 0, SEEK_CUR);
+    f->seekable = pos >= 0;
+    f->tag = f->end_tag = f->pos_tag = std::max(pos, (off_t) 0);
+    f->ra_start = f->ra_end = f->wbase = f->fd_pos = f->pos_tag;
+
+    size_t nslots = write_blocks;
+    if (mode == O_RDONLY) {
+        nslots = cache_param("IO61_SLOTS", default_nslots, 1 << 16);
+    }
+    size_t want = cache_param("IO61_SLOTSIZE", default_slotsize, 1 << 26);
+    f->slotsize = 512;
+    while ((size_t) f->slotsize < want) {
+        f->slotsize *= 2;
+    }
+    f->slotmem = (unsigned char*) aligned_alloc(f->slotsize, nslots * f->slotsize);
+    assert(f->slotmem);
+    f->slots.resize(nslots);
+    for (size_t i = 0; i != nslots; ++i) {
+        f->slots[i].buf = f->slotmem + i * f->slotsize;
+    }
+    size_t nbuckets = 1;
+    while (nbuckets < 2 * nslots) {
+        nbuckets *= 2;
+    }
+    f->index.assign(nbuckets, -1);
+    f->ra_max = std::max(std::min(nslots / 2, max_readahead), (size_t) 1);
+    f->cbuf = f->slotmem;
+    f->wcap = nslots * f->slotsize;
     return f;
 }
 
@@ -54,34 +132,199 @@ io61_file* io61_fdopen(int fd, int mode) {
 
 int io61_close(io61_file* f) {
     io61_flush(f);
-    if (f->map_addr != MAP_FAILED){
-        munmap(f->map_addr, io61_filesize(f)); //closing map if exists
-    }   
     int r = close(f->fd);
+    free(f->slotmem);
+    free(f->scratch);
     delete f;
     return r;
 }
 
-ssize_t cache_fill (io61_file* f){
-    assert(f->tag <= f->pos_tag && f->pos_tag <= f->end_tag);
-    assert(f->end_tag - f->pos_tag <= f->bufsize);
 
-    f->tag = f->pos_tag = f->end_tag;
-    ssize_t n = read(f->fd, f->cbuf, f->bufsize);
-    if (n > 0) {
-        f->end_tag = f->tag + n;
+// cache_find(f, tag)
+//    Returns the slot holding the block at `tag`, or nullptr if it isn't
+//    resident.
+
+static io61_slot* cache_find(io61_file* f, off_t tag) {
+    int i = f->index[(tag / f->slotsize) & (f->index.size() - 1)];
+    while (i >= 0 && f->slots[i].tag != tag) {
+        i = f->slots[i].next;
     }
-    if (n <= 0) {
-        if (errno == EINTR || errno == EAGAIN){
-            cache_fill(f); // trying again
+    return i >= 0 ? &f->slots[i] : nullptr;
+}
+
+
+// cache_claim(f, tag, keep_lo, keep_hi)
+//    Claims a slot for the block at `tag` by CLOCK replacement and returns
+//    it, empty. Slots for blocks in [keep_lo, keep_hi) are not replaced.
+
+static io61_slot* cache_claim(io61_file* f, off_t tag, off_t keep_lo, off_t keep_hi) {
+    //skip recently used slots, clearing their bits as the hand passes
+    while (f->slots[f->hand].referenced
+           || (f->slots[f->hand].tag >= keep_lo && f->slots[f->hand].tag < keep_hi)) {
+        f->slots[f->hand].referenced = false;
+        f->hand = (f->hand + 1) % f->slots.size();
+    }
+    int victim = f->hand;
+    f->hand = (f->hand + 1) % f->slots.size();
+
+    io61_slot* s = &f->slots[victim];
+    if (s->tag >= 0) {
+        int* pp = &f->index[(s->tag / f->slotsize) & (f->index.size() - 1)];
+        while (*pp != victim) {
+            pp = &f->slots[*pp].next;
         }
-        else {
-            return -1;
+        *pp = s->next;
+    }
+    int& head = f->index[(tag / f->slotsize) & (f->index.size() - 1)];
+    s->tag = s->end_tag = tag;
+    s->next = head;
+    head = victim;
+    return s;
+}
+
+
+// cache_read(f, s)
+//    Reads the rest of slot `s`'s block from the file. If this read picks
+//    up where the last one ended, reads are going forward: it also fills
+//    slots for the blocks that follow. If `s` is the block just before
+//    where the last one started, reads are going backward: it fills slots
+//    for the blocks before `s` instead, so the window ends at `s`. Either
+//    way the window is twice as many blocks as last time in that
+//    direction (up to `f->ra_max`). If the last three misses were the same
+//    distance apart, and that stride is short enough for a window to hold
+//    several strided blocks, reads are strided: the window runs from `s`
+//    for up to `f->ra_max` blocks in the stride's direction, and the next
+//    strided blocks in it get slots. The window is read with one readv.
+//    Any other read goes back to one block. Returns the number of bytes
+//    read, 0 at end of file, or -1 on error.
+
+static ssize_t cache_read(io61_file* f, io61_slot* s) {
+    bool forward = s->end_tag == f->ra_end;
+    bool backward = f->seekable && s->end_tag == s->tag
+        && s->tag + f->slotsize == f->ra_start;
+    off_t delta = s->tag - f->st_last;
+    off_t span = std::abs(delta) / f->slotsize;
+    bool strided = !forward && !backward && f->seekable && s->end_tag == s->tag
+        && delta == f->st_delta && span >= 2 && 2 * span <= (off_t) f->ra_max;
+    f->st_delta = delta;
+    f->st_last = s->tag;
+    if (forward || backward) {
+        if (backward != f->ra_backward) {
+            f->ra_backward = backward;
+            f->ra_blocks = 1;
         }
+        f->ra_blocks = std::min(2 * f->ra_blocks, f->ra_max);
+    } else {
+        f->ra_blocks = 1;
     }
-    assert(f->tag <= f->pos_tag && f->pos_tag <= f->end_tag);
-    assert(f->end_tag - f->pos_tag <= f->bufsize);
-    return n;
+    bool advise = forward && f->ra_blocks == f->ra_max;
+    if (advise != f->ra_advised && f->seekable) {
+        posix_fadvise(f->fd, 0, 0, advise ? POSIX_FADV_SEQUENTIAL : POSIX_FADV_NORMAL);
+        f->ra_advised = advise;
+    }
+
+    //pick the window [lo, lo + n blocks), stopping at blocks already here
+    //unless reads are strided
+    off_t lo = s->tag;
+    size_t n = 1;
+    if (strided) {
+        n = (f->ra_max - 1) / span * span + 1;
+        if (delta < 0) {
+            n = std::min(n, (size_t) (s->tag / f->slotsize + 1));
+            lo = s->tag - (n - 1) * f->slotsize;
+        }
+        if (!f->scratch) {
+            f->scratch = (unsigned char*) malloc(f->slotsize);
+            assert(f->scratch);
+        }
+        //the next miss should be one stride past the last strided block
+        f->st_last = lo + (delta < 0 ? 0 : n - 1) * f->slotsize;
+    } else if (backward) {
+        while (n < f->ra_blocks && lo >= f->slotsize
+               && !cache_find(f, lo - f->slotsize)) {
+            lo -= f->slotsize;
+            ++n;
+        }
+    } else {
+        while (n < f->ra_blocks && !cache_find(f, lo + n * f->slotsize)) {
+            ++n;
+        }
+    }
+    io61_slot* window[max_readahead];
+    off_t from[max_readahead];
+    struct iovec iov[max_readahead];
+    for (size_t i = 0; i != n; ++i) {
+        off_t t = lo + i * f->slotsize;
+        if (strided && (t - s->tag) % delta != 0) {
+            //blocks between strided ones are read into scratch space, so
+            //they don't push strided blocks out of the cache
+            window[i] = nullptr;
+            from[i] = t;
+            iov[i].iov_base = f->scratch;
+            iov[i].iov_len = f->slotsize;
+            continue;
+        }
+        window[i] = t == s->tag ? s : (strided ? cache_find(f, t) : nullptr);
+        if (!window[i]) {
+            window[i] = cache_claim(f, t, lo, lo + n * f->slotsize);
+        }
+        //resident blocks in a strided window are read again in full
+        from[i] = window[i] == s ? s->end_tag : t;
+        iov[i].iov_base = window[i]->buf + (from[i] - t);
+        iov[i].iov_len = t + f->slotsize - from[i];
+    }
+
+    ssize_t nr;
+    do {
+        if (f->seekable) {
+            nr = preadv(f->fd, iov, n, from[0]);
+        } else {
+            nr = readv(f->fd, iov, n);
+        }
+    } while (nr < 0 && (errno == EINTR || errno == EAGAIN));
+
+    f->ra_start = from[0];
+    f->ra_end = from[0] + std::max(nr, (ssize_t) 0);
+    for (size_t i = 0, left = f->ra_end - from[0]; i != n && left != 0; ++i) {
+        size_t k = std::min(left, iov[i].iov_len);
+        if (window[i]) {
+            window[i]->end_tag = std::max(window[i]->end_tag, from[i] + (off_t) k);
+        }
+        left -= k;
+    }
+    return nr;
+}
+
+
+// cache_fill(f)
+//    Makes the slot holding `f->pos_tag` current, reading the rest of its
+//    block if it doesn't reach that far yet. Returns the number of bytes
+//    available at `f->pos_tag`: 0 at end of file, -1 on error.
+
+ssize_t cache_fill (io61_file* f){
+    assert(f->mode == O_RDONLY);
+    off_t tag = f->pos_tag & ~(f->slotsize - 1);
+    io61_slot* s = cache_find(f, tag);
+    if (!s) {
+        s = cache_claim(f, tag, tag, tag);
+    }
+    s->referenced = true;
+    if (s->end_tag <= f->pos_tag
+        && s->end_tag < s->tag + f->slotsize
+        && cache_read(f, s) < 0) {
+        f->tag = f->end_tag = f->pos_tag;
+        return -1;
+    }
+    if (s->end_tag <= f->pos_tag) {
+        //at (or past) end of file
+        f->tag = f->end_tag = f->pos_tag;
+        return 0;
+    }
+    f->cbuf = s->buf;
+    f->tag = s->tag;
+    f->end_tag = s->end_tag;
+    assert(f->tag <= f->pos_tag && f->pos_tag < f->end_tag);
+    return f->end_tag - f->pos_tag;
 }
 
 
@@ -102,65 +345,176 @@ int io61_readc(io61_file* f) {
 }
 
 
+// read_direct(f, buf, sz)
+//    Reads up to `sz` bytes at `f->pos_tag` straight into `buf` with one
+//    pread, leaving the cache alone. Seekable files only: in a pipe, the
+//    cache has to see every byte so that blocks fill from the right place.
+//    Returns the number of bytes read, 0 at end of file, or -1 on error.
+
+static ssize_t read_direct(io61_file* f, unsigned char* buf, size_t sz) {
+    assert(f->seekable);
+    ssize_t nr;
+    do {
+        nr = pread(f->fd, buf, sz, f->pos_tag);
+    } while (nr < 0 && (errno == EINTR || errno == EAGAIN));
+    if (nr > 0) {
+        f->ra_start = f->pos_tag;
+        f->pos_tag += nr;
+        f->ra_end = f->tag = f->end_tag = f->pos_tag;
+    }
+    return nr;
+}
+
+
 // iteration 2
 ssize_t io61_read(io61_file* f, unsigned char* buf, size_t sz) {
     // Check invariants.
+    assert(f->tag <= f->pos_tag && f->pos_tag <= f->end_tag);
+    assert(f->end_tag - f->tag <= f->slotsize);
     size_t pos = 0;
-    if (f->map_addr == MAP_FAILED){
-        assert(f->tag <= f->pos_tag && f->pos_tag <= f->end_tag);
-        assert(f->end_tag - f->pos_tag <= f->bufsize);
-        while (pos < sz) {
-            // If the cache is empty, refill it.
-            if (f->pos_tag == f->end_tag) {
-                ssize_t c = cache_fill(f);
-                if (c == 0){
-                    break;
-                }
-                // If the cache is still empty after a fill, we're at EOF or an error occurred.
-                if (f->pos_tag == f->end_tag) {
-                    break;
-                }
+    while (pos < sz) {
+        // Requests at least a readahead window long skip the cache once
+        // the current slot is used up.
+        if (f->pos_tag == f->end_tag && f->seekable
+            && sz - pos >= f->ra_max * f->slotsize) {
+            ssize_t c = read_direct(f, buf + pos, sz - pos);
+            if (c < 0 && pos == 0) {
+                return -1;
+            } else if (c <= 0) {
+                break;
             }
-            // Determine the number of bytes to read from the cache.
-            size_t bytes_to_copy = std::min((long) (f->end_tag - f->pos_tag), (long) (sz - pos));
+            pos += c;
+            continue;
+        }
+        // If the current slot is used up, move to the next block.
+        if (f->pos_tag == f->end_tag) {
+            ssize_t c = cache_fill(f);
+            if (c < 0 && pos == 0) {
+                return -1;
+            } else if (c <= 0) {
+                break;
+            }
+        }
+        // Determine the number of bytes to read from the cache.
+        size_t bytes_to_copy = std::min((long) (f->end_tag - f->pos_tag), (long) (sz - pos));
 
-            // Use memcpy to copy the data into provided buffer
-            memcpy(buf + pos, f->cbuf + (f->pos_tag - f->tag), bytes_to_copy);
+        // Use memcpy to copy the data into provided buffer
+        memcpy(buf + pos, f->cbuf + (f->pos_tag - f->tag), bytes_to_copy);
 
-            // Update the positions in the buffer and cache.
-            f->pos_tag += bytes_to_copy;
-            pos += bytes_to_copy;
-        }
-    }
-    else { //IF MEMORY MAPPED
-        ssize_t bytes_to_copy = std::min(sz, (size_t)(f->st.st_size - f->pos_tag));
-        memcpy(buf + pos, (unsigned char*)f->map_addr + f->pos_tag, bytes_to_copy);
+        // Update the positions in the buffer and cache.
         f->pos_tag += bytes_to_copy;
-        pos = bytes_to_copy;
-        }
+        pos += bytes_to_copy;
+    }
     return pos;
 }
+// write_prepare(f, sz)
+//    Gets the write buffer ready for `sz` bytes (at most `f->wcap`) at
+//    `f->pos_tag`. Writes that touch the current extent join it if they
+//    fit, including writes just below it, so data written backward collects
+//    in the buffer too. In a seekable file, other writes that fit start a
+//    new extent, so strided writes share the buffer. Otherwise the buffer
+//    is flushed and restarted. If the new write ends where the old extent
+//    started, writes are going backward, and the new buffer is placed to
+//    grow downward from there. Returns 0 on success, -1 if the flush failed.
+
+static int write_prepare(io61_file* f, size_t sz) {
+    off_t lo = f->pos_tag, hi = f->pos_tag + sz;
+    if (f->tag < f->end_tag) {
+        bool fits = lo >= f->wbase && hi <= f->wbase + f->wcap;
+        if (fits && lo <= f->end_tag && hi >= f->tag) {
+            return 0;
+        } else if (fits && f->seekable && f->wdirty.size() < max_extents) {
+            f->wdirty.emplace_back(f->tag, f->end_tag);
+            f->tag = f->end_tag = lo;
+            return 0;
+        }
+        f->wbackward = hi == f->tag;
+    }
+    if (io61_flush(f) < 0) {
+        return -1;
+    }
+    f->wbase = f->wbackward ? hi - f->wcap : lo;
+    return 0;
+}
+
+static void write_store(io61_file* f, const unsigned char* buf, size_t sz) {
+    memcpy(f->cbuf + (f->pos_tag - f->wbase), buf, sz);
+    f->tag = std::min(f->tag, f->pos_tag);
+    f->pos_tag += sz;
+    f->end_tag = std::max(f->end_tag, f->pos_tag);
+}
+
+
 // io61_writec(f)
 //    Write a single character `c` to `f` (converted to unsigned char).
 //    Returns 0 on success and -1 on error.
 
 int io61_writec(io61_file* f, int c) {
     unsigned char ch = c;
-    if (f->end_tag == f->tag + f->bufsize) {
-        ssize_t flush = io61_flush(f);
-        if (flush < 0) {
-            return -1;  // Return -1 on end of file or error.
+    if (f->pos_tag < f->tag || f->pos_tag > f->end_tag
+        || f->pos_tag == f->wbase + f->wcap) {
+        if (write_prepare(f, 1) < 0) {
+            return -1;
         }
     }
-    memcpy(f->cbuf + (f->pos_tag - f->tag), &ch, 1);
-    ++f->pos_tag;
-    if (f->pos_tag > f->end_tag) {
-            f->end_tag = f->pos_tag; //going beyond
-        }
+    write_store(f, &ch, 1);
     return 0;
 }
 
 
+// write_direct(f, buf, sz)
+//    Writes `sz` bytes from `buf` at `f->pos_tag` without copying them into
+//    the write buffer. If the buffer holds one extent that ends at
+//    `f->pos_tag`, it goes out in the same writev; anything else buffered
+//    is flushed first. Returns the number of bytes of `buf` written, or -1
+//    if none were written before an error.
+
+static ssize_t write_direct(io61_file* f, const unsigned char* buf, size_t sz) {
+    if (f->tag < f->end_tag
+        && (f->end_tag != f->pos_tag || !f->wdirty.empty())
+        && io61_flush(f) < 0) {
+        return -1;
+    }
+    size_t pos = 0;
+    while (pos < sz) {
+        struct iovec iov[2];
+        int niov = 0;
+        if (f->tag < f->end_tag) {
+            iov[niov].iov_base = f->cbuf + (f->tag - f->wbase);
+            iov[niov].iov_len = f->end_tag - f->tag;
+            ++niov;
+        }
+        iov[niov].iov_base = (void*) (buf + pos);
+        iov[niov].iov_len = sz - pos;
+        ++niov;
+        off_t off = f->tag < f->end_tag ? f->tag : f->pos_tag;
+        ssize_t n;
+        if (off == f->fd_pos || !f->seekable) {
+            n = writev(f->fd, iov, niov);
+        } else {
+            n = pwritev(f->fd, iov, niov, off);
+        }
+        if (n < 0 && (errno == EINTR || errno == EAGAIN)) {
+            continue; //if recoverable error
+        } else if (n <= 0) {
+            break;
+        }
+        if (off == f->fd_pos) {
+            f->fd_pos += n;
+        }
+        //buffered bytes went first
+        size_t k = std::min((size_t) n, (size_t) (f->end_tag - f->tag));
+        f->tag += k;
+        pos += n - k;
+        f->pos_tag += n - k;
+    }
+    if (f->tag == f->end_tag) {
+        f->tag = f->end_tag = f->wbase = f->pos_tag;
+    }
+    return pos ? (ssize_t) pos : -1;
+}
+
+
 // io61_write(f, buf, sz)
 //    Writes `sz` characters from `buf` to `f`. Returns `sz` on success.
 //    Can write fewer than `sz` characters when there is an error, such as
@@ -170,29 +524,28 @@ int io61_writec(io61_file* f, int c) {
 
 ssize_t io61_write(io61_file* f, const unsigned char* buf, size_t sz) {
     // Check invariants.
-    assert(f->tag <= f->pos_tag && f->pos_tag <= f->end_tag);
-    assert(f->end_tag - f->pos_tag <= f->bufsize);
-
-    ssize_t pos = 0;
-    while (pos < (ssize_t) sz) {
-        // If the cache is full, empty it.
-        if (f->end_tag == f->tag + f->bufsize) {
-            ssize_t fl = io61_flush(f);
-            // If the cache is still non-empty after a flush, some error occured or ran out of drive space
-            if (fl == -1) {
-                return (std::max(((long) pos) - 1, (long) -1)); //checking if anything has already been written, in which case we return that otherwise -1. 
-            }
-        }
-        // Determine the number of bytes to write this time
-        size_t bytes_to_write = std::min(sz - pos, (size_t) (f->tag + f->bufsize - f->pos_tag));
+    assert(f->wbase <= f->tag && f->tag <= f->end_tag);
+    assert(f->end_tag <= f->wbase + f->wcap);
 
-        // Use memcpy to copy the data into provided buffer
-        memcpy(f->cbuf + (f->pos_tag - f->tag), buf + pos, bytes_to_write);
+    // Writes at least as big as the buffer go straight to the file.
+    if (sz >= (size_t) f->wcap) {
+        return write_direct(f, buf, sz);
+    }
 
-        // Update the positions in the buffer and cache.
-        f->pos_tag += bytes_to_write;
-        f->end_tag += bytes_to_write;
-        pos += bytes_to_write;
+    size_t pos = 0;
+    while (pos < sz) {
+        // Fill the rest of the buffer if this lands in it, otherwise
+        // start a new one.
+        size_t n = std::min(sz - pos, (size_t) f->wcap);
+        if (f->tag < f->end_tag && f->pos_tag >= f->wbase
+            && f->pos_tag < f->wbase + f->wcap) {
+            n = std::min(sz - pos, (size_t) (f->wbase + f->wcap - f->pos_tag));
+        }
+        if (write_prepare(f, n) < 0) {
+            return pos ? (ssize_t) pos : -1;
+        }
+        write_store(f, buf + pos, n);
+        pos += n;
     }
     return pos;
 }
@@ -210,23 +563,53 @@ int io61_flush(io61_file* f) { //keep retrying until restartable errors go away
     if (f->mode == O_RDONLY){ 
         return 0;
     } 
-    assert(f->end_tag - f->pos_tag <= f->bufsize);
-    ssize_t towrite = f->pos_tag - f->tag;
-    size_t pos = 0;
-    while ((ssize_t) pos < towrite) {
-        ssize_t n = write(f->fd, f->cbuf + pos, towrite - pos); //writing to memory
-        if (n < 0){
-            if (errno == EINTR || errno == EAGAIN){
-                continue;
-            } //if recoverable error
-            else
-            {
-                break;
-            }
+    //write extents out in file order, merging any that touch
+    auto& runs = f->wdirty;
+    if (f->tag < f->end_tag) {
+        runs.emplace_back(f->tag, f->end_tag);
+    }
+    std::sort(runs.begin(), runs.end());
+    size_t nruns = 0;
+    for (auto& r : runs) {
+        if (nruns != 0 && r.first <= runs[nruns - 1].second) {
+            runs[nruns - 1].second = std::max(runs[nruns - 1].second, r.second);
+        } else {
+            runs[nruns++] = r;
+        }
+    }
+    runs.resize(nruns);
+
+    size_t i = 0;
+    while (i != runs.size()) {
+        off_t lo = runs[i].first, hi = runs[i].second;
+        const unsigned char* data = f->cbuf + (lo - f->wbase);
+        ssize_t n;
+        if (lo == f->fd_pos || !f->seekable) {
+            n = write(f->fd, data, hi - lo);
+        } else {
+            //data after a seek goes out without moving `fd`
+            n = pwrite(f->fd, data, hi - lo, lo);
+        }
+        if (n < 0 && (errno == EINTR || errno == EAGAIN)) {
+            continue; //if recoverable error
+        } else if (n <= 0) {
+            //the rest stays buffered
+            runs.erase(runs.begin(), runs.begin() + i);
+            f->tag = runs.back().first;
+            f->end_tag = runs.back().second;
+            runs.pop_back();
+            return -1;
+        }
+        if (lo == f->fd_pos) {
+            f->fd_pos += n;
+        }
+        runs[i].first += n;
+        if (runs[i].first == hi) {
+            ++i;
         }
-        pos +=n; //loop next condition
     }
-    f->tag = f->pos_tag; //setting tag = postab
+    runs.clear();
+    f->tag = f->end_tag = f->wbase = f->pos_tag;
     return 0;
 }
 
@@ -236,45 +619,27 @@ int io61_flush(io61_file* f) { //keep retrying until restartable errors go away
 //    Returns 0 on success and -1 on failure.
 
 int io61_seek(io61_file* f, off_t off) {
-    if(f->map_addr == MAP_FAILED){ //if no mapping
-        if (off >= f->tag && off < f-> end_tag){
-            f->pos_tag = off;
-            return 0;
-        }
-        if (f->mode == O_RDONLY){
-            off_t off_a = off - (off % f->bufsize); //align
-            off_t lsresult = lseek(f->fd, off_a, SEEK_SET);
-            if(lsresult == -1){
-                return -1;
-            }
-            f->tag = f->end_tag = f->pos_tag = off_a;
-            cache_fill(f);
-            if(f->pos_tag == f->end_tag){ //error
-                return -1;
-            }
-            f->pos_tag += (off % f->bufsize); //align
-            return 0;
-        }
-        else if (f->mode == O_WRONLY){
-            io61_flush(f);
-            off_t lsresult = lseek(f->fd, off, SEEK_SET);
-            if (lsresult != -1){
-                f->tag = f->end_tag = f->pos_tag = off;
-            }
-            return 0;
-        }
-        return -1;
+    if (off >= f->tag && off < f-> end_tag){
+        f->pos_tag = off;
+        return 0;
     }
-    else{ //if mapping then directly set to f->pos_tag since that is the only relevant thing. 
-        off_t filesize = io61_filesize(f);
-        if (off > filesize){
+    if (f->mode == O_RDONLY){
+        if (!f->seekable || off < 0){
             return -1;
         }
-        else {
-            f->pos_tag = off;
+        //the next read finds (or fills) the slot holding `off`
+        f->tag = f->end_tag = f->pos_tag = off;
+        return 0;
+    }
+    else if (f->mode == O_WRONLY){
+        if (off < 0 || (!f->seekable && off != f->pos_tag)){
+            return -1;
         }
+        //the next write joins the buffer if it can (see write_prepare)
+        f->pos_tag = off;
+        return 0;
     }
-
+    return -1;
 }
 
 
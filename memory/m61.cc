@@ -5,8 +5,20 @@
 #include <cstdio>
 #include <cinttypes>
 #include <cassert>
+#include <cerrno>
 #include <sys/mman.h>
+#include <sys/stat.h>
+#include <sys/types.h>
+#include <fcntl.h>
+#include <signal.h>
+#include <unistd.h>
+#include <algorithm>
+#include <atomic>
 #include <map>
+#include <mutex>
+#include <set>
+#include <unordered_map>
+#include <vector>
 #include <iostream>
 
 // New variable initializations
@@ -18,110 +30,2064 @@ static m61_statistics gstats = {
     .nfail = 0,
     .fail_size = 0,
     .heap_min = UINTPTR_MAX,
-    .heap_max = 0
+    .heap_max = 0,
+    .realloc_copied = 0,
+    .heap_mapped = 0,
+    .heap_resident = 0,
+    .heap_backing = M61_PAGES_NORMAL
 };
-//struct to hold information about each entry into malloc
-struct properties {
-    size_t actual_size;
-    size_t padding_size;
-    const char* file;
-    int line;
+
+//every block in the heap starts with one of these, so all the bookkeeping lives
+//in the heap itself. blocks are laid out back to back: the next block starts
+//`block_size(h)` bytes after h, and the heap ends with a size-0 allocated header.
+//free blocks also end with a footer (their size in the last 8 bytes), which the
+//following block finds through its BLOCK_PREV_FREE bit to coalesce downwards.
+struct block_header {
+    size_t size;                    // bytes in the block including this header; low 4 bits are flags
+    union {
+        uint32_t site;              // allocation site id (allocated blocks)
+        uint32_t dirty;             // pages that may be resident (free blocks, see below)
+    };
+    uint32_t check;                 // header_check() of this header, catches forged/stale pointers
+    union {
+        size_t req;                 // requested size (allocated blocks)
+        block_header* next_free;    // links in a size bin (free blocks)
+    };
+    block_header* prev_free;
+};
+
+constexpr size_t BLOCK_ALLOC = 1;       // block is allocated
+constexpr size_t BLOCK_PREV_FREE = 2;   // block right before this one is free
+constexpr size_t BLOCK_SLAB = 4;        // allocated block holds a slab page
+constexpr size_t BLOCK_MMAP = 8;        // allocated block is its own mapping, not in an arena
+constexpr size_t BLOCK_FLAGS = 15;
+constexpr size_t header_size = sizeof(block_header);
+
+constexpr size_t min_block = header_size + 16;  // room for header and footer
+
+static size_t block_size(const block_header* h) {
+    return h->size & ~BLOCK_FLAGS;
+}
+static block_header* block_next(block_header* h) {
+    return (block_header*) ((char*) h + block_size(h));
+}
+static char* block_payload(block_header* h) {
+    return (char*) h + header_size;
+}
+
+//every block and slab slot reserves a red zone after its object: at least
+//redzone_size bytes, running to a 16-byte boundary. m61_malloc fills it
+//all, and m61_free and the heap scanner check it all, so a write a few
+//bytes past the end is caught however the object's size is rounded
+constexpr size_t redzone_size = 16;
+static size_t redzone_end(size_t sz) {      // offset of the red zone's end
+    return (sz + redzone_size + 15) & ~size_t(15);
+}
+static void redzone_fill(char* ptr, size_t sz) {
+    memset(ptr + sz, 61, redzone_end(sz) - sz);
+}
+//is the red zone after the sz-byte object at ptr intact? ptr is 16-byte
+//aligned, so the red zone is the end of one 16-byte chunk plus (unless sz is
+//a multiple of 16) all of the next, and a vector compare checks each chunk
+typedef unsigned char byte_vector __attribute__((vector_size(16)));
+static bool redzone_intact(const char* ptr, size_t sz) {
+    const byte_vector lanes = {0, 1, 2, 3, 4, 5, 6, 7, 8, 9, 10, 11, 12, 13, 14, 15};
+    byte_vector bad = {};
+    for (size_t off = sz & ~size_t(15); off != redzone_end(sz); off += 16) {
+        byte_vector chunk;
+        memcpy(&chunk, ptr + off, sizeof(chunk));
+        unsigned char from = off < sz ? sz - off : 0;
+        bad |= (chunk != 61) & (lanes >= from);
+    }
+    uint64_t words[2];
+    memcpy(words, &bad, sizeof(words));
+    return (words[0] | words[1]) == 0;
+}
+static uint32_t header_check(const block_header* h) {
+    return (((uintptr_t) h ^ h->size) * 0x9E3779B97F4A7C15ULL) >> 32;
+}
+static void set_header(block_header* h, size_t size, size_t flags) {
+    h->size = size | flags;
+    h->check = header_check(h);
+}
+static void set_prev_free(block_header* h, bool prev_free) {
+    set_header(h, block_size(h), (h->size & BLOCK_FLAGS & ~BLOCK_PREV_FREE) | (prev_free ? BLOCK_PREV_FREE : 0));
+}
+
+
+//free blocks are kept in size bins: one bin per 16 bytes below 1 KiB, then 8 bins
+//per power of two. a bitmap of non-empty bins finds the next bin that can hold a
+//request in O(1), and every block in a higher bin is big enough.
+constexpr int nbins = 64 + 8 * 54;
+block_header* bins[nbins];
+uint64_t bin_map[(nbins + 63) / 64];
+static m61_fit_policy fit_policy = M61_BEST_FIT;
+
+//with M61_SITE_FIT, a free block can be the cursor of a site pool (see
+//site_pool below): the block that pool's site carves its next objects from.
+//the word after a free block's header says whose cursor it is (pool + 1),
+//or 0, so losing a cursor block to a merge or a carve is noticed at once
+constexpr int max_site_pools = 256;
+block_header* site_cursors[max_site_pools];
+
+static uint64_t& free_tag(block_header* h) {
+    return *(uint64_t*) ((char*) h + header_size);
+}
+constexpr size_t free_header_size = header_size + sizeof(uint64_t);
+
+static int bin_index(size_t sz) {
+    if (sz < 1024) {
+        return sz / 16;
+    }
+    int fl = 63 - __builtin_clzll(sz);
+    return 64 + (fl - 10) * 8 + ((sz >> (fl - 3)) & 7);
+}
+
+//first non-empty bin at index >= b, or nbins
+static int bin_next_nonempty(int b) {
+    for (int w = b / 64; w < (nbins + 63) / 64; ++w) {
+        uint64_t bits = bin_map[w];
+        if (w == b / 64) {
+            bits &= ~uint64_t(0) << (b % 64);
+        }
+        if (bits) {
+            return w * 64 + __builtin_ctzll(bits);
+        }
+    }
+    return nbins;
+}
+
+//free memory goes back to the OS a page at a time. each free block knows which
+//of its inner pages (the whole pages strictly inside it; the pages holding its
+//header, free tag and footer stay in use) might still be resident: a span of pages,
+//`dirty`, outside which everything was madvised away or never touched, so it
+//reads as zero. freeing a block adds its pages to the span of the merged free
+//block; once that span reaches release_batch bytes it is madvised away and
+//emptied. batching keeps a free/malloc pair at the edge of a big free block
+//from faulting a page in and out every time
+constexpr size_t os_page_size = 4096;
+constexpr size_t release_batch = 64 << 10;
+//(arenas on transparent huge pages release whole huge pages only, since
+//releasing part of one splits it; see release_granule below)
+static size_t release_granule(const void* ptr);
+//(the pages of a persistent heap's file need MADV_REMOVE, which also frees
+//their disk blocks; after MADV_DONTNEED they would read back the old data)
+static int release_advice = MADV_DONTNEED;
+size_t released_bytes;                  // inner bytes of free blocks outside their dirty spans
+size_t nfree_blocks;                    // blocks in the bins
+size_t free_bytes;                      // and their total size
+
+struct page_span {
+    uintptr_t lo;
+    uintptr_t hi;
+};
+static page_span inner_pages(block_header* h, size_t size) {
+    uintptr_t lo = ((uintptr_t) h + free_header_size + os_page_size - 1) & ~(os_page_size - 1);
+    uintptr_t hi = ((uintptr_t) h + size - sizeof(size_t)) & ~(os_page_size - 1);
+    return {lo, hi > lo ? hi : lo};
+}
+//smallest span covering a and b (either may be empty)
+static page_span span_hull(page_span a, page_span b) {
+    if (a.lo >= a.hi) {
+        return b;
+    } else if (b.lo >= b.hi) {
+        return a;
+    }
+    return {std::min(a.lo, b.lo), std::max(a.hi, b.hi)};
+}
+//the dirty span of free block h, from page offsets relative to its inner
+//pages (an arena has 2048 pages, so 16 bits each is plenty)
+static page_span dirty_pages(block_header* h) {
+    page_span inner = inner_pages(h, block_size(h));
+    return {inner.lo + (h->dirty & 0xFFFF) * os_page_size,
+            inner.lo + (h->dirty >> 16) * os_page_size};
+}
+
+//marks h free (keeping its PREV_FREE bit), with pages outside `dirty` known
+//released, writes its footer, and puts it in its bin
+static void free_insert(block_header* h, size_t size, page_span dirty) {
+    set_header(h, size, h->size & BLOCK_PREV_FREE);
+    page_span inner = inner_pages(h, size);
+    dirty.lo = std::max(dirty.lo, inner.lo);
+    dirty.hi = std::min(dirty.hi, inner.hi);
+    if (dirty.lo >= dirty.hi) {
+        dirty = {inner.lo, inner.lo};
+    }
+    h->dirty = (dirty.lo - inner.lo) / os_page_size | (dirty.hi - inner.lo) / os_page_size << 16;
+    released_bytes += (inner.hi - inner.lo) - (dirty.hi - dirty.lo);
+    ++nfree_blocks;
+    free_bytes += size;
+    free_tag(h) = 0;
+    *(size_t*) ((char*) h + size - sizeof(size_t)) = size;
+    int b = bin_index(size);
+    h->prev_free = nullptr;
+    h->next_free = bins[b];
+    if (bins[b]) {
+        bins[b]->prev_free = h;
+    }
+    bins[b] = h;
+    bin_map[b / 64] |= uint64_t(1) << (b % 64);
+    set_prev_free(block_next(h), true);
+}
+
+//size of the largest block in the bins, 0 if none. it is in the highest
+//non-empty bin, so the bitmap finds that bin and only it is searched.
+//only the statistics want this, so nothing keeps it up to date
+static size_t free_largest() {
+    size_t largest = 0;
+    for (int w = (nbins + 63) / 64 - 1; w >= 0; --w) {
+        if (bin_map[w]) {
+            int top = w * 64 + 63 - __builtin_clzll(bin_map[w]);
+            for (block_header* h = bins[top]; h; h = h->next_free) {
+                largest = std::max(largest, block_size(h));
+            }
+            break;
+        }
+    }
+    return largest;
+}
+
+static void free_remove(block_header* h) {
+    page_span inner = inner_pages(h, block_size(h));
+    page_span dirty = dirty_pages(h);
+    released_bytes -= (inner.hi - inner.lo) - (dirty.hi - dirty.lo);
+    --nfree_blocks;
+    free_bytes -= block_size(h);
+    if (uint64_t tag = free_tag(h)) {
+        site_cursors[tag - 1] = nullptr;
+    }
+    int b = bin_index(block_size(h));
+    if (h->prev_free) {
+        h->prev_free->next_free = h->next_free;
+    } else {
+        bins[b] = h->next_free;
+        if (!bins[b]) {
+            bin_map[b / 64] &= ~(uint64_t(1) << (b % 64));
+        }
+    }
+    if (h->next_free) {
+        h->next_free->prev_free = h->prev_free;
+    }
+}
+
+//the heap scanner's place (see scan_step): always the start of a block, so a
+//block that merges into the one before it takes the cursor along
+block_header* scan_cursor;
+static void scan_forget(block_header* gone, block_header* into) {
+    if (scan_cursor == gone) {
+        scan_cursor = into;
+    }
+}
+
+//returns the block at h (already marked not allocated) to the free bins,
+//merging it with free neighbors. both checks are O(1) thanks to the tags
+static void free_block_release(block_header* h) {
+    size_t size = block_size(h);
+    //every page h touches may be resident, and so may the pages holding a
+    //free neighbor's footer or header (and free tag), which end up inside
+    //the merged block
+    page_span dirty = {((uintptr_t) h - sizeof(size_t)) & ~(os_page_size - 1),
+                       ((uintptr_t) h + size + free_header_size + os_page_size - 1) & ~(os_page_size - 1)};
+
+    //Coalesce down
+    if (h->size & BLOCK_PREV_FREE) {
+        size_t prev_size = *(size_t*) ((char*) h - sizeof(size_t));
+        block_header* prev = (block_header*) ((char*) h - prev_size);
+        dirty = span_hull(dirty, dirty_pages(prev));
+        free_remove(prev);
+        scan_forget(h, prev);
+        size += prev_size;
+        h = prev;
+    }
+
+    //Coalesce up
+    block_header* next = (block_header*) ((char*) h + size);
+    if (!(next->size & BLOCK_ALLOC)) {
+        dirty = span_hull(dirty, dirty_pages(next));
+        free_remove(next);
+        scan_forget(next, h);
+        size += block_size(next);
+    }
+
+    page_span inner = inner_pages(h, size);
+    dirty.lo = std::max(dirty.lo, inner.lo);
+    dirty.hi = std::min(dirty.hi, inner.hi);
+    //(madvise can fail, e.g. on hugetlbfs pages; then the pages stay dirty)
+    if (dirty.hi > dirty.lo && dirty.hi - dirty.lo >= release_batch) {
+        size_t granule = release_granule(h);
+        page_span out = {(dirty.lo + granule - 1) & ~(granule - 1), dirty.hi & ~(granule - 1)};
+        if (out.hi > out.lo
+            && madvise((void*) out.lo, out.hi - out.lo, release_advice) == 0) {
+            //the dirty span stays one span: it loses the released pages
+            //unless they were in the middle of it (then they still count
+            //as resident, and may be released again later)
+            if (out.lo == dirty.lo) {
+                dirty.lo = out.hi;
+            } else if (out.hi == dirty.hi) {
+                dirty.hi = out.lo;
+            }
+        }
+    }
+    free_insert(h, size, dirty);
+}
+
+//takes `size` bytes at offset `off` of free block h out of the free bins. the
+//pieces before and after go back as free blocks; a tail too small to be a
+//block of its own stays attached. returns the carved block, not yet marked
+static block_header* free_carve(block_header* h, size_t off, size_t size) {
+    size_t total = block_size(h);
+    page_span dirty = dirty_pages(h);
+    assert(off == 0 || off >= min_block);
+    free_remove(h);
+    block_header* b = (block_header*) ((char*) h + off);
+    if (off > 0) {
+        free_insert(h, off, dirty);
+    }
+    size_t prev_free = off > 0 ? BLOCK_PREV_FREE : (h->size & BLOCK_PREV_FREE);
+    if (total - off - size >= min_block) {
+        block_header* rest = (block_header*) ((char*) b + size);
+        rest->size = 0;                 // b is about to be allocated, not free
+        free_insert(rest, total - off - size, dirty);
+    } else {
+        size = total - off;
+        set_prev_free((block_header*) ((char*) b + size), false);
+    }
+    b->size = size | prev_free;
+    return b;
+}
+
+//the heap is a list of arenas, each its own mapping laid out as above. the
+//first one is default_buffer; more are mapped when nothing fits. arenas are
+//never unmapped before exit, so the list only grows and can be read without
+//the lock
+constexpr size_t arena_size = 8 << 20;  /* 8 MiB */
+constexpr int max_arenas = 64;
+constexpr size_t huge_page_size = 2 << 20;
+
+//arenas can be backed by huge pages, to cut TLB misses for workloads that
+//chase pointers all over the heap. build with HUGEPAGES=1 or run with
+//M61_HUGEPAGES=1 in the environment (M61_HUGEPAGES=0 turns it off again)
+#ifndef M61_HUGEPAGES
+#define M61_HUGEPAGES 0
+#endif
+static bool want_huge_pages() {
+    const char* env = getenv("M61_HUGEPAGES");
+    return env ? strcmp(env, "0") != 0 : M61_HUGEPAGES;
+}
+
+//a persistent heap (M61_HEAP_FILE=FILE in the environment) lives in FILE,
+//mapped shared at a fixed address so the pointers stored in it mean the same
+//thing in every run. the file is a persistent_header followed by the arenas,
+//back to back. the blocks already hold everything else worth keeping, except
+//that headers and slab pages name their sites by this run's ids, so the file
+//also keeps the sites' names. the bins, slab lists and statistics are rebuilt
+//from the blocks when a later run opens the file (see persistent_open)
+constexpr uint64_t persistent_magic = 0x317061656831366D;      // "m61heap1"
+constexpr uintptr_t persistent_default_base = 0x7E8000000000;     // (free under ASan and TSan too)
+constexpr size_t persistent_header_size = 64 << 10;
+constexpr uint32_t persistent_max_sites = 2048;
+constexpr uint32_t persistent_no_name = UINT32_MAX;
+struct persistent_site {
+    uint32_t name;                  // offset of the file name in `names`, or persistent_no_name
+    int32_t line;
+};
+struct persistent_header {
+    uint64_t magic;
+    uintptr_t base;                 // where the file is mapped
+    uint64_t arena_size;
+    uint64_t narenas;
+    void* root;                     // see m61_set_root
+    uint32_t nsites;
+    uint32_t names_size;
+    persistent_site sites[persistent_max_sites];    // indexed by site id
+    char names[persistent_header_size - 48 - persistent_max_sites * sizeof(persistent_site)];
 };
+static_assert(sizeof(persistent_header) == persistent_header_size);
+static persistent_header* pheap;        // the mapped file, if the heap is persistent
+static int pheap_fd = -1;
 
-std::map<void*, size_t> freed_addresses;
-std::map<void*, properties> active_addresses;
-int highest_free = 0;
+static const char* persistent_file() {
+    const char* path = getenv("M61_HEAP_FILE");
+    return path && *path ? path : nullptr;
+}
+
+//where arena i of the persistent heap starts
+static char* persistent_arena(size_t i) {
+    return (char*) pheap + persistent_header_size + i * arena_size;
+}
 
 struct m61_memory_buffer {
     char* buffer;
     size_t pos = 0;
-    size_t size = 8 << 20; /* 8 MiB */
+    size_t size = arena_size;
+    m61_page_backing backing = M61_PAGES_NORMAL;
+    //one bit per page, set if that page is a slab page (see below)
+    uint64_t slab_frames[arena_size / 4096 / 64] = {};
 
     m61_memory_buffer();
+    explicit m61_memory_buffer(char* buf);
     ~m61_memory_buffer();
+    void format();
 };
 
 static m61_memory_buffer default_buffer;
+m61_memory_buffer* arenas[max_arenas] = {&default_buffer};
+std::atomic<int> narenas{1};
+
 
+//does the kernel hand out transparent huge pages to regions that ask?
+//(madvise(MADV_HUGEPAGE) succeeds even when they are turned off)
+static bool transparent_huge_enabled() {
+    int fd = open("/sys/kernel/mm/transparent_hugepage/enabled", O_RDONLY);
+    if (fd < 0) {
+        return false;
+    }
+    char buf[128];
+    ssize_t n = read(fd, buf, sizeof(buf) - 1);
+    close(fd);
+    buf[n > 0 ? n : 0] = '\0';
+    return strstr(buf, "[always]") || strstr(buf, "[madvise]");
+}
+
+//maps a huge-page-aligned region and asks for transparent huge pages, or
+//returns nullptr if they are unavailable
+static void* map_transparent_huge(size_t size) {
+    if (!transparent_huge_enabled()) {
+        return nullptr;
+    }
+    //over-map, then trim to a huge page boundary at each end
+    void* raw = mmap(nullptr, size + huge_page_size, PROT_WRITE, MAP_ANON | MAP_PRIVATE, -1, 0);
+    if (raw == MAP_FAILED) {
+        return nullptr;
+    }
+    uintptr_t start = ((uintptr_t) raw + huge_page_size - 1) & ~(huge_page_size - 1);
+    if (start != (uintptr_t) raw) {
+        munmap(raw, start - (uintptr_t) raw);
+    }
+    uintptr_t raw_end = (uintptr_t) raw + size + huge_page_size;
+    if (raw_end != start + size) {
+        munmap((void*) (start + size), raw_end - (start + size));
+    }
+    if (madvise((void*) start, size, MADV_HUGEPAGE) != 0) {
+        munmap((void*) start, size);
+        return nullptr;
+    }
+    return (void*) start;
+}
 
 m61_memory_buffer::m61_memory_buffer() {
-    void* buf = mmap(nullptr,    // Place the buffer at a random address
-        this->size,              // Buffer should be 8 MiB big
-        PROT_WRITE,              // We want to read and write the buffer
-        MAP_ANON | MAP_PRIVATE, -1, 0);
-                                 // We want memory freshly allocated by the OS
-    assert(buf != MAP_FAILED);
+    //a persistent heap's first arena is in its file, mapped once everything
+    //else is set up
+    if (persistent_file()) {
+        this->buffer = nullptr;
+        this->size = 0;
+        return;
+    }
+    void* buf = MAP_FAILED;
+    if (want_huge_pages()) {
+        //transparent huge pages, then reserved hugetlbfs pages, then normal ones
+        if (void* thp = map_transparent_huge(this->size)) {
+            buf = thp;
+            this->backing = M61_PAGES_TRANSPARENT_HUGE;
+        } else {
+            buf = mmap(nullptr, this->size, PROT_WRITE, MAP_ANON | MAP_PRIVATE | MAP_HUGETLB, -1, 0);
+            if (buf != MAP_FAILED) {
+                this->backing = M61_PAGES_HUGETLB;
+            }
+        }
+    }
+    if (buf == MAP_FAILED) {
+        buf = mmap(nullptr,          // Place the buffer at a random address
+            this->size,              // Buffer should be 8 MiB big
+            PROT_WRITE,              // We want to read and write the buffer
+            MAP_ANON | MAP_PRIVATE, -1, 0);
+                                     // We want memory freshly allocated by the OS
+    }
+    if (buf == MAP_FAILED) {
+        this->buffer = nullptr;
+        this->size = 0;
+        return;
+    }
     this->buffer = (char*) buf;
-    freed_addresses.insert ({(void*)buffer, size});
+    format();
+}
+
+//an arena in memory that is already mapped
+m61_memory_buffer::m61_memory_buffer(char* buf)
+    : buffer(buf) {
+}
+
+//lays out a fresh arena: one free block covering everything but the end marker
+void m61_memory_buffer::format() {
+    block_header* end = (block_header*) (buffer + size - header_size);
+    set_header(end, 0, BLOCK_ALLOC);
+    block_header* first = (block_header*) buffer;
+    first->size = 0;
+    //fresh anonymous memory (or a file's new hole) isn't resident until touched
+    free_insert(first, size - header_size, {0, 0});
 }
 
 m61_memory_buffer::~m61_memory_buffer() {
-    munmap(this->buffer, this->size);
+    if (this->buffer) {
+        munmap(this->buffer, this->size);
+    }
+}
+
+//returns the arena containing ptr, or nullptr
+static m61_memory_buffer* arena_of(const void* ptr) {
+    int n = narenas.load(std::memory_order_acquire);
+    for (int i = 0; i != n; ++i) {
+        if ((uintptr_t) ptr - (uintptr_t) arenas[i]->buffer < arenas[i]->size) {
+            return arenas[i];
+        }
+    }
+    return nullptr;
+}
+
+//the unit free pages go back to the OS in, for the arena holding ptr
+static size_t release_granule(const void* ptr) {
+    m61_memory_buffer* a = arena_of(ptr);
+    return a && a->backing == M61_PAGES_TRANSPARENT_HUGE ? huge_page_size : os_page_size;
+}
+
+//maps one more arena and puts its memory in the free bins. heap_lock must be
+//held. returns false if we are out of arenas or the OS is out of memory
+static bool add_arena() {
+    int n = narenas.load(std::memory_order_relaxed);
+    if (n == max_arenas) {
+        return false;
+    }
+    m61_memory_buffer* a;
+    if (pheap) {
+        //the persistent heap's arenas are already mapped; the file grows
+        if (ftruncate(pheap_fd, persistent_header_size + (n + 1) * arena_size) != 0) {
+            return false;
+        }
+        a = new m61_memory_buffer(persistent_arena(n));
+        a->format();
+        pheap->narenas = n + 1;
+    } else {
+        a = new m61_memory_buffer;
+        if (!a->buffer) {
+            delete a;
+            return false;
+        }
+    }
+    arenas[n] = a;
+    narenas.store(n + 1, std::memory_order_release);
+    return true;
+}
+
+
+//allocation sites (file:line pairs) interned to small integer ids, so blocks and
+//slab objects can remember where they came from in 4 bytes instead of 16.
+//open addressing over a power-of-two table, id 0 is the unknown site.
+struct site_entry {
+    const char* file;
+    int line;
+};
+std::vector<site_entry> sites = {{"?", 0}};
+std::vector<uint32_t> site_table(1024, 0);   // holds id + 1, 0 means empty
+
+static size_t site_hash(const char* file, int line) {
+    uintptr_t h = (uintptr_t) file * 0x9E3779B97F4A7C15ULL;
+    return (h >> 17) ^ (unsigned) line * 0x85EBCA6BU;
 }
 
-//getting value of first pointer in the heap
-void* first_heap = freed_addresses.begin()->first;
+//per-site heap profile counters. the thread cache fast paths update these
+//without the lock, so they are atomics and live in chunks that never move
+//(unlike `sites`, which reallocates as it grows)
+struct site_counters {
+    std::atomic<unsigned long long> live_count;
+    std::atomic<unsigned long long> live_size;
+    std::atomic<unsigned long long> total_count;
+    std::atomic<unsigned long long> total_size;
+    std::atomic<unsigned long long> peak_size;
+    std::atomic<uint32_t> pool;     // site pool + 1, 0 if none yet, or site_no_pool
+};
+constexpr uint32_t site_no_pool = UINT32_MAX;   // hot, but the pools ran out
+constexpr size_t site_chunk = 1024;
+site_counters first_site_chunk[site_chunk];
+site_counters* site_chunks[1 << 16] = {first_site_chunk};   // room for 64M sites
+
+//the heap-wide live size histogram and peak are kept alongside, since every
+//allocation, free and in-place resize goes through the site counters
+constexpr int size_buckets = sizeof(m61_extended_statistics::size_histogram) / sizeof(unsigned long long);
+std::atomic<unsigned long long> live_histogram[size_buckets];
+std::atomic<unsigned long long> live_bytes;
+std::atomic<unsigned long long> peak_live_bytes;
+
+static int size_bucket(size_t sz) {
+    return sz == 0 ? 0 : std::min(64 - __builtin_clzll(sz), size_buckets - 1);
+}
+
+static void live_add(size_t sz) {
+    live_histogram[size_bucket(sz)].fetch_add(1, std::memory_order_relaxed);
+    unsigned long long live = live_bytes.fetch_add(sz, std::memory_order_relaxed) + sz;
+    unsigned long long peak = peak_live_bytes.load(std::memory_order_relaxed);
+    while (live > peak
+           && !peak_live_bytes.compare_exchange_weak(peak, live, std::memory_order_relaxed)) {
+    }
+}
+
+static void live_remove(size_t sz) {
+    live_histogram[size_bucket(sz)].fetch_sub(1, std::memory_order_relaxed);
+    live_bytes.fetch_sub(sz, std::memory_order_relaxed);
+}
+
+static site_counters& site_stats(uint32_t id) {
+    return site_chunks[id / site_chunk][id % site_chunk];
+}
+
+static void site_alloc(uint32_t id, size_t sz) {
+    site_counters& sc = site_stats(id);
+    sc.live_count.fetch_add(1, std::memory_order_relaxed);
+    unsigned long long live = sc.live_size.fetch_add(sz, std::memory_order_relaxed) + sz;
+    sc.total_count.fetch_add(1, std::memory_order_relaxed);
+    sc.total_size.fetch_add(sz, std::memory_order_relaxed);
+    unsigned long long peak = sc.peak_size.load(std::memory_order_relaxed);
+    while (live > peak
+           && !sc.peak_size.compare_exchange_weak(peak, live, std::memory_order_relaxed)) {
+    }
+    live_add(sz);
+}
+
+static void site_free(uint32_t id, size_t sz) {
+    site_counters& sc = site_stats(id);
+    sc.live_count.fetch_sub(1, std::memory_order_relaxed);
+    sc.live_size.fetch_sub(sz, std::memory_order_relaxed);
+    live_remove(sz);
+}
+
+//an object from site id changed size in place (m61_realloc)
+static void site_resize(uint32_t id, size_t old_sz, size_t sz) {
+    site_counters& sc = site_stats(id);
+    unsigned long long live = sc.live_size.fetch_add(sz - old_sz, std::memory_order_relaxed) + (sz - old_sz);
+    unsigned long long peak = sc.peak_size.load(std::memory_order_relaxed);
+    while (sz > old_sz && live > peak
+           && !sc.peak_size.compare_exchange_weak(peak, live, std::memory_order_relaxed)) {
+    }
+    live_remove(old_sz);
+    live_add(sz);
+}
+
+//records site id's name in the persistent heap, if there is one with room.
+//each name is kept once, since every run adds its sites again
+static void persistent_note_site(uint32_t id) {
+    if (!pheap || id >= persistent_max_sites) {
+        return;
+    }
+    const char* file = sites[id].file;
+    uint32_t name = 0;
+    while (name < pheap->names_size && strcmp(pheap->names + name, file) != 0) {
+        name += strlen(pheap->names + name) + 1;
+    }
+    size_t len = strlen(file) + 1;
+    if (name == pheap->names_size && name + len <= sizeof(pheap->names)) {
+        memcpy(pheap->names + name, file, len);
+        pheap->names_size += len;
+    } else if (name == pheap->names_size) {
+        name = persistent_no_name;
+    }
+    pheap->sites[id] = {name, sites[id].line};
+    pheap->nsites = std::max(pheap->nsites, id + 1);
+}
+
+static uint32_t site_id(const char* file, int line) {
+    size_t mask = site_table.size() - 1;
+    for (size_t i = site_hash(file, line) & mask; ; i = (i + 1) & mask) {
+        if (site_table[i] == 0) {
+            if (sites.size() % site_chunk == 0) {
+                site_chunks[sites.size() / site_chunk] = new site_counters[site_chunk]();
+            }
+            sites.push_back({file, line});
+            site_table[i] = sites.size() - 1 + 1;
+            persistent_note_site(sites.size() - 1);
+            break;
+        }
+        const site_entry& s = sites[site_table[i] - 1];
+        if (s.file == file && s.line == line) {
+            return site_table[i] - 1;
+        }
+    }
+    //keep the table at most half full
+    if (2 * sites.size() > site_table.size()) {
+        std::vector<uint32_t> bigger(2 * site_table.size(), 0);
+        mask = bigger.size() - 1;
+        for (uint32_t id = 1; id < sites.size(); ++id) {
+            size_t i = site_hash(sites[id].file, sites[id].line) & mask;
+            while (bigger[i] != 0) {
+                i = (i + 1) & mask;
+            }
+            bigger[i] = id + 1;
+        }
+        site_table.swap(bigger);
+    }
+    return sites.size() - 1;
+}
+
+
+//small objects (<= 240 bytes) come from slab pages instead of their own blocks. a
+//slab page is a page-aligned 4096-byte block (BLOCK_SLAB) split into equal slots
+//of one size class (32, 48, ..., 256 bytes, each object with its red zone). occupancy
+//is a bitmap; the only other per-object data is the requested size (1 byte, for
+//the red zone and statistics) and the allocation site id (4 bytes, for diagnostics).
+//layout: [block_header][slots ...][site ids][sizes][slab_page header]
+constexpr size_t slab_page_size = 4096;
+constexpr size_t slab_max = 256;            // slot size of the largest class
+constexpr size_t slab_max_object = slab_max - redzone_size;
+constexpr int slab_nclasses = slab_max / 16;
+//site id of a slot that is free but parked in some thread's cache (its
+//bitmap bit stays set until the cache hands it back)
+constexpr uint32_t slab_cached = UINT32_MAX;
+
+struct slab_page {
+    uint64_t used[4];                       // occupancy bitmap, one bit per slot
+    slab_page* prev;                        // links in the class's partial list
+    slab_page* next;
+    uint16_t slot_size;
+    uint16_t nslots;
+    uint16_t nused;
+    uint16_t owner;                         // site pool + 1, or 0 if shared
+};
+
+//pages of each class that still have a free slot
+slab_page* slab_partial[slab_nclasses];
+
+//with M61_SITE_FIT, each site that has made site_hot_count allocations gets
+//a pool, so its objects sit next to each other instead of wherever a free
+//slot or block happened to be: slab pages of its own for small objects, and
+//a cursor block that its bigger objects are carved from front to back.
+//(other sites carve from the back of someone else's cursor, if they must.)
+//slots of pool pages skip the thread caches, which would hand them to
+//other sites
+constexpr unsigned long long site_hot_count = 64;
+constexpr size_t site_chunk_size = 64 << 10;    // smallest fresh cursor block
+struct site_pool {
+    slab_page* partial[slab_nclasses];      // pages with a free slot
+};
+site_pool site_pools[max_site_pools];
+int nsite_pools;
+
+//the list of partial pages sp belongs on
+static slab_page*& slab_list(slab_page* sp, int c) {
+    return sp->owner ? site_pools[sp->owner - 1].partial[c] : slab_partial[c];
+}
+
+static m61_fit_policy current_fit_policy() {
+    //(read without the lock on the small-object path)
+    return std::atomic_ref<m61_fit_policy>(fit_policy).load(std::memory_order_relaxed);
+}
+
+//could site have a pool? (a quick check that needs no lock)
+static bool site_hot(uint32_t site) {
+    return current_fit_policy() == M61_SITE_FIT && site != 0
+        && site_stats(site).total_count.load(std::memory_order_relaxed) >= site_hot_count
+        && site_stats(site).pool.load(std::memory_order_relaxed) != site_no_pool;
+}
+
+//the pool of site if it has (or now gets) one, otherwise -1. sites that
+//don't say where they are ("?") share too much to be worth a pool.
+//heap_lock must be held
+static int site_pool_of(uint32_t site) {
+    if (!site_hot(site)) {
+        return -1;
+    }
+    site_counters& sc = site_stats(site);
+    uint32_t pool = sc.pool.load(std::memory_order_relaxed);
+    if (pool == 0) {
+        pool = nsite_pools == max_site_pools ? site_no_pool : ++nsite_pools;
+        sc.pool.store(pool, std::memory_order_relaxed);
+    }
+    return pool == site_no_pool ? -1 : int(pool) - 1;
+}
+
+//makes free block h (or nothing) pool's cursor
+static void set_site_cursor(int pool, block_header* h) {
+    if (site_cursors[pool]) {
+        free_tag(site_cursors[pool]) = 0;
+    }
+    site_cursors[pool] = h;
+    if (h) {
+        free_tag(h) = pool + 1;
+    }
+}
+
+//the bitmaps are only changed with heap_lock held, but the free fast path
+//reads them without it, so every access goes through an atomic_ref
+static uint64_t load_bits(uint64_t& word) {
+    return std::atomic_ref<uint64_t>(word).load(std::memory_order_relaxed);
+}
+static void store_bits(uint64_t& word, uint64_t bits) {
+    std::atomic_ref<uint64_t>(word).store(bits, std::memory_order_relaxed);
+}
+
+static int slab_class(size_t sz) {
+    return redzone_end(sz) / 16 - 1;
+}
+static char* slab_base(slab_page* sp) {
+    return (char*) ((uintptr_t) sp & ~(slab_page_size - 1));
+}
+static char* slab_slots(slab_page* sp) {
+    return slab_base(sp) + header_size;
+}
+static uint32_t* slab_sites(slab_page* sp) {
+    return (uint32_t*) (slab_slots(sp) + sp->nslots * sp->slot_size);
+}
+static uint8_t* slab_sizes(slab_page* sp) {
+    return (uint8_t*) (slab_sites(sp) + sp->nslots);
+}
+static bool slab_used(slab_page* sp, size_t slot) {
+    return (load_bits(sp->used[slot / 64]) >> (slot % 64)) & 1;
+}
+static slab_page* slab_of_block(block_header* h) {
+    return (slab_page*) ((char*) h + slab_page_size - sizeof(slab_page));
+}
+
+//returns the slab page containing ptr, which is in arena a, or nullptr if
+//ptr is not in one
+static slab_page* slab_in(m61_memory_buffer* a, void* ptr) {
+    size_t frame = ((char*) ptr - a->buffer) / slab_page_size;
+    if (!((load_bits(a->slab_frames[frame / 64]) >> (frame % 64)) & 1)) {
+        return nullptr;
+    }
+    return slab_of_block((block_header*) (a->buffer + frame * slab_page_size));
+}
+
+//returns the slab page containing ptr, or nullptr if ptr is not in one
+static slab_page* slab_lookup(void* ptr) {
+    m61_memory_buffer* a = arena_of(ptr);
+    return a ? slab_in(a, ptr) : nullptr;
+}
+
+//slot index of ptr if it is the start of a slot of sp, otherwise -1
+static ssize_t slab_slot(slab_page* sp, void* ptr) {
+    if ((char*) ptr < slab_slots(sp)) {
+        return -1;
+    }
+    size_t off = (char*) ptr - slab_slots(sp);
+    if (off % sp->slot_size != 0 || off / sp->slot_size >= sp->nslots) {
+        return -1;
+    }
+    return off / sp->slot_size;
+}
+
+static void slab_set_frame(char* page, bool is_slab) {
+    m61_memory_buffer* a = arena_of(page);
+    size_t frame = (page - a->buffer) / slab_page_size;
+    uint64_t bits = load_bits(a->slab_frames[frame / 64]);
+    if (is_slab) {
+        bits |= uint64_t(1) << (frame % 64);
+    } else {
+        bits &= ~(uint64_t(1) << (frame % 64));
+    }
+    store_bits(a->slab_frames[frame / 64], bits);
+}
+
+static void slab_unlink(slab_page* sp, int c) {
+    if (sp->prev) {
+        sp->prev->next = sp->next;
+    } else {
+        slab_list(sp, c) = sp->next;
+    }
+    if (sp->next) {
+        sp->next->prev = sp->prev;
+    }
+    sp->prev = sp->next = nullptr;
+}
+
+static void slab_push(slab_page* sp, int c) {
+    sp->prev = nullptr;
+    sp->next = slab_list(sp, c);
+    if (sp->next) {
+        sp->next->prev = sp;
+    }
+    slab_list(sp, c) = sp;
+}
+
+//where a page-aligned block of slab_page_size could start inside free block h
+//(the piece left in front must be empty or a whole block), or 0 if none fits
+static uintptr_t slab_fit(block_header* h) {
+    uintptr_t start = (uintptr_t) h;
+    uintptr_t page = (start + slab_page_size - 1) & ~(slab_page_size - 1);
+    if (page != start && page - start < min_block) {
+        page += slab_page_size;
+    }
+    return page + slab_page_size <= start + block_size(h) ? page : 0;
+}
+
+//takes a page-aligned block out of the free bins, or returns nullptr
+static block_header* carve_slab_page() {
+    //blocks this big always have room for an aligned page; smaller ones might
+    //not, so look at a few of those before falling back on the big ones
+    int big = bin_index(2 * slab_page_size + min_block) + 1;
+    int tries = 0;
+    for (int b = bin_next_nonempty(bin_index(slab_page_size)); b < big && tries < 8;
+         b = bin_next_nonempty(b + 1)) {
+        for (block_header* h = bins[b]; h && tries < 8; h = h->next_free, ++tries) {
+            if (uintptr_t page = slab_fit(h)) {
+                return free_carve(h, page - (uintptr_t) h, slab_page_size);
+            }
+        }
+    }
+    int b = bin_next_nonempty(big);
+    if (b == nbins) {
+        return nullptr;
+    }
+    block_header* h = bins[b];
+    uintptr_t page = slab_fit(h);
+    return free_carve(h, page - (uintptr_t) h, slab_page_size);
+}
+
+static slab_page* slab_new_page(int c, uint16_t owner) {
+    block_header* h = carve_slab_page();
+    if (!h) {
+        return nullptr;
+    }
+    set_header(h, block_size(h), (h->size & BLOCK_PREV_FREE) | BLOCK_ALLOC | BLOCK_SLAB);
+    slab_page* sp = slab_of_block(h);
+    memset(sp, 0, sizeof(slab_page));
+    sp->slot_size = (c + 1) * 16;
+    //each slot costs its bytes plus a site id and a size byte
+    sp->nslots = (slab_page_size - header_size - sizeof(slab_page)) / (sp->slot_size + sizeof(uint32_t) + 1);
+    sp->owner = owner;
+    slab_set_frame((char*) h, true);
+    slab_push(sp, c);
+    return sp;
+}
+
+static void slab_release_page(slab_page* sp, int c) {
+    slab_unlink(sp, c);
+    block_header* h = (block_header*) slab_base(sp);
+    slab_set_frame((char*) h, false);
+    set_header(h, block_size(h), h->size & BLOCK_PREV_FREE);
+    free_block_release(h);
+}
+
+//takes a free slot of class c out of the shared slab pages (or those of
+//site pool owner - 1), or returns nullptr. the slot comes back marked as
+//parked in a thread cache. heap_lock must be held
+static char* slab_take(int c, uint16_t owner = 0) {
+    slab_page* sp = owner ? site_pools[owner - 1].partial[c] : slab_partial[c];
+    if (!sp && !(sp = slab_new_page(c, owner))) {
+        return nullptr;
+    }
+    size_t w = 0;
+    while (sp->used[w] == ~uint64_t(0)) {
+        ++w;
+    }
+    size_t slot = w * 64 + __builtin_ctzll(~sp->used[w]);
+    assert(slot < sp->nslots);
+    store_bits(sp->used[w], sp->used[w] | (uint64_t(1) << (slot % 64)));
+    if (++sp->nused == sp->nslots) {
+        slab_unlink(sp, c);
+    }
+    slab_sites(sp)[slot] = slab_cached;
+    return slab_slots(sp) + slot * sp->slot_size;
+}
+
+//gives a slot back to its page. heap_lock must be held
+static void slab_put(slab_page* sp, size_t slot) {
+    int c = sp->slot_size / 16 - 1;
+    if (sp->nused == sp->nslots) {
+        slab_push(sp, c);
+    }
+    store_bits(sp->used[slot / 64], sp->used[slot / 64] & ~(uint64_t(1) << (slot % 64)));
+    --sp->nused;
+    //hand empty pages back to the heap, but keep the class's last one around
+    if (sp->nused == 0 && (slab_list(sp, c) != sp || sp->next)) {
+        slab_release_page(sp, c);
+    }
+}
+
+//true if ptr is a live slab object with its red zone intact; sets *slot
+static bool slab_live(slab_page* sp, void* ptr, ssize_t* slot) {
+    *slot = slab_slot(sp, ptr);
+    return *slot >= 0 && slab_used(sp, *slot)
+        && slab_sites(sp)[*slot] != slab_cached
+        && redzone_intact((char*) ptr, slab_sizes(sp)[*slot]);
+}
+
+//explains why the slab object ptr can't be freed and aborts
+static void slab_report_invalid_free(slab_page* sp, void* ptr, const char* file, int line) {
+    ssize_t slot = slab_slot(sp, ptr);
+    if (slot >= 0 && (!slab_used(sp, slot) || slab_sites(sp)[slot] == slab_cached)) {
+        std::cerr << "MEMORY BUG: "<<file<<":"<<line<<": invalid free of pointer "<< ptr <<", double free\n";
+        abort();
+    }
+    if (slot >= 0) {
+        std::cerr << "MEMORY BUG: "<<file<<":"<<line<<": detected wild write during free of pointer "<< ptr <<"\n";
+        abort();
+    }
+    std::cerr << "MEMORY BUG: "<<file<<":"<<line<<": invalid free of pointer "<< ptr <<", not allocated\n";
+    if ((char*) ptr >= slab_slots(sp)) {
+        size_t off = (char*) ptr - slab_slots(sp);
+        slot = off / sp->slot_size;
+        if ((size_t) slot < sp->nslots && slab_used(sp, slot) && slab_sites(sp)[slot] != slab_cached) {
+            const site_entry& site = sites[slab_sites(sp)[slot]];
+            std::cerr <<site.file<<":"<<site.line<<": "<< ptr <<" is "<< off % sp->slot_size <<" bytes inside a "<<(size_t) slab_sizes(sp)[slot]<<" byte region allocated here\n";
+        }
+    }
+    abort();
+}
+
+//gives the empty pages kept around by slab_put back to the heap; called
+//when a big allocation doesn't fit, returns true if anything was released
+static bool slab_release_empty() {
+    bool released = false;
+    for (int pool = -1; pool != nsite_pools; ++pool) {
+        for (int c = 0; c != slab_nclasses; ++c) {
+            slab_page* sp = pool < 0 ? slab_partial[c] : site_pools[pool].partial[c];
+            while (sp) {
+                slab_page* next = sp->next;
+                if (sp->nused == 0) {
+                    slab_release_page(sp, c);
+                    released = true;
+                }
+                sp = next;
+            }
+        }
+    }
+    return released;
+}
+
+
+//everything above is shared by all threads and only touched with heap_lock
+//held. to keep small objects from serializing on it, each thread parks freed
+//slab slots in its own per-class cache and allocates from there; the cache
+//goes back to the slab pages (the central pool) for tcache_batch slots at a
+//time, under one lock acquisition, when it runs empty or fills up.
+std::mutex heap_lock;
+constexpr int tcache_max = 64;              // cached slots per class per thread
+constexpr int tcache_batch = 32;            // slots moved per refill or drain
+
+struct thread_cache {
+    char* slots[slab_nclasses][tcache_max];
+    int count[slab_nclasses] = {};
+    //recently used sites, so the shared site table needs the lock only on a miss
+    struct {
+        const char* file;
+        int line;
+        uint32_t id;
+    } site_cache[64] = {};
+    //statistics for allocations served from the cache, which m61_get_statistics
+    //adds to gstats. they are unsigned and wrap when this thread frees objects
+    //another thread allocated, which still adds up correctly
+    std::atomic<unsigned long long> nactive{0};
+    std::atomic<unsigned long long> active_size{0};
+    std::atomic<unsigned long long> ntotal{0};
+    std::atomic<unsigned long long> total_size{0};
+    //allocations until the next one goes to the guarded pool, when sampling
+    long sample_countdown = 0;
+    uint64_t sample_random = 0;
+    //allocations and frees until the next heap scanner step, when scanning
+    long scan_countdown = 0;
+    thread_cache* prev;                     // registry of live thread caches
+    thread_cache* next;
+
+    thread_cache();
+    ~thread_cache();
+};
+
+thread_cache* thread_caches;
+static thread_local thread_cache tcache;
+
+//counters are written only by their own thread, so no read-modify-write needed
+static void bump(std::atomic<unsigned long long>& x, unsigned long long delta) {
+    x.store(x.load(std::memory_order_relaxed) + delta, std::memory_order_relaxed);
+}
+
+//heap_min and heap_max are read by the free fast path without the lock
+static bool in_heap_bounds(void* ptr) {
+    uintptr_t addr = (uintptr_t) ptr;
+    return addr >= std::atomic_ref<uintptr_t>(gstats.heap_min).load(std::memory_order_relaxed)
+        && addr <= std::atomic_ref<uintptr_t>(gstats.heap_max).load(std::memory_order_relaxed);
+}
+
+//widens [heap_min, heap_max] to include [lo, hi). heap_lock must be held
+static void note_heap_range(uintptr_t lo, uintptr_t hi) {
+    if (gstats.heap_min > lo) {
+        std::atomic_ref<uintptr_t>(gstats.heap_min).store(lo, std::memory_order_relaxed);
+    }
+    if (gstats.heap_max < hi) {
+        std::atomic_ref<uintptr_t>(gstats.heap_max).store(hi, std::memory_order_relaxed);
+    }
+}
+
+//moves n slots of class c from the cache back to the slab pages. heap_lock must be held
+static void tcache_drain(thread_cache& tc, int c, int n) {
+    while (n > 0 && tc.count[c] > 0) {
+        char* ptr = tc.slots[c][--tc.count[c]];
+        slab_page* sp = slab_lookup(ptr);
+        slab_put(sp, slab_slot(sp, ptr));
+        --n;
+    }
+}
+
+static void tcache_flush(thread_cache& tc) {
+    for (int c = 0; c != slab_nclasses; ++c) {
+        tcache_drain(tc, c, tc.count[c]);
+    }
+}
+
+static void tcache_refill(thread_cache& tc, int c) {
+    std::lock_guard<std::mutex> guard(heap_lock);
+    while (tc.count[c] < tcache_batch) {
+        char* ptr = slab_take(c);
+        if (!ptr) {
+            break;
+        }
+        tc.slots[c][tc.count[c]++] = ptr;
+    }
+}
+
+static uint32_t tcache_site(thread_cache& tc, const char* file, int line) {
+    auto& entry = tc.site_cache[site_hash(file, line) % 64];
+    if (entry.file != file || entry.line != line) {
+        std::lock_guard<std::mutex> guard(heap_lock);
+        entry = {file, line, site_id(file, line)};
+    }
+    return entry.id;
+}
+
+thread_cache::thread_cache() {
+    std::lock_guard<std::mutex> guard(heap_lock);
+    prev = nullptr;
+    next = thread_caches;
+    if (next) {
+        next->prev = this;
+    }
+    thread_caches = this;
+}
+
+thread_cache::~thread_cache() {
+    //the thread is going away: give back its slots and keep its statistics
+    std::lock_guard<std::mutex> guard(heap_lock);
+    tcache_flush(*this);
+    gstats.nactive += nactive.load(std::memory_order_relaxed);
+    gstats.active_size += active_size.load(std::memory_order_relaxed);
+    gstats.ntotal += ntotal.load(std::memory_order_relaxed);
+    gstats.total_size += total_size.load(std::memory_order_relaxed);
+    if (prev) {
+        prev->next = next;
+    } else {
+        thread_caches = next;
+    }
+    if (next) {
+        next->prev = prev;
+    }
+}
+
+
+//returns the header of the block whose payload starts at ptr, or nullptr if
+//there is no believable header there (misaligned, outside the heap, or a
+//check value that doesn't match, e.g. a header copied somewhere else)
+static block_header* header_of(void* ptr) {
+    uintptr_t addr = (uintptr_t) ptr;
+    m61_memory_buffer* a = arena_of(ptr);
+    if (addr % alignof(std::max_align_t) != 0 || !a
+        || addr < (uintptr_t) a->buffer + header_size) {
+        return nullptr;
+    }
+    block_header* h = (block_header*) (addr - header_size);
+    if (h->check != header_check(h) || block_size(h) < min_block
+        || (char*) h + block_size(h) > a->buffer + a->size) {
+        return nullptr;
+    }
+    return h;
+}
+
+//walks ptr's arena from the start to find the block containing ptr (slow, only
+//used to explain errors); returns nullptr if ptr isn't inside any block
+static block_header* block_containing(void* ptr) {
+    m61_memory_buffer* a = arena_of(ptr);
+    if (!a) {
+        return nullptr;
+    }
+    block_header* h = (block_header*) a->buffer;
+    while (block_size(h) != 0) {
+        if ((char*) ptr >= (char*) h && (char*) ptr < (char*) block_next(h)) {
+            return h;
+        }
+        h = block_next(h);
+    }
+    return nullptr;
+}
+
+//picks the free block for a general allocation of `needed` bytes according
+//to fit_policy, or returns nullptr if nothing fits
+static block_header* find_free_block(size_t needed) {
+    if (fit_policy != M61_FIRST_FIT) {
+        //look through the request's own bin for a block that fits, then take
+        //the first block of the next non-empty bin, which always fits
+        int b = bin_index(needed);
+        int tries = 0;
+        for (block_header* h = bins[b]; h && tries < 16; h = h->next_free, ++tries) {
+            if (block_size(h) >= needed) {
+                return h;
+            }
+        }
+        b = bin_next_nonempty(b + 1);
+        return b < nbins ? bins[b] : nullptr;
+    }
+    //first fit: walk every block of every arena in address order
+    for (int i = 0; i != narenas.load(std::memory_order_relaxed); ++i) {
+        block_header* h = (block_header*) arenas[i]->buffer;
+        while (block_size(h) != 0) {
+            if (!(h->size & BLOCK_ALLOC) && block_size(h) >= needed) {
+                return h;
+            }
+            h = block_next(h);
+        }
+    }
+    return nullptr;
+}
+
+
+//allocations of at least mmap_threshold bytes skip the arenas and get a
+//mapping of their own, [block_header (BLOCK_MMAP)][payload ...], which m61_free
+//unmaps again. the live ones are kept in big_blocks so m61_free can tell them
+//from garbage without touching memory that might not be mapped
+constexpr size_t mmap_threshold = 1 << 20;
+std::set<block_header*> big_blocks;
+size_t big_mapped_bytes;                // total size of their mappings
+
+//does an allocation of sz bytes get a mapping of its own? (not in a
+//persistent heap, which keeps everything in its file's arenas)
+static bool wants_mapping(size_t sz) {
+    return sz >= mmap_threshold && !pheap;
+}
+
+//a big block's mapping starts at the page holding its header: the header
+//sits further in only for alignments past 16, where the pages in front of it
+//are unmapped again
+static char* big_mapping(block_header* h) {
+    return (char*) ((uintptr_t) h & ~(slab_page_size - 1));
+}
+
+static size_t big_mapping_size(block_header* h) {
+    return (char*) h - big_mapping(h) + block_size(h);
+}
+
+static void* big_alloc(size_t sz, const char* file, int line,
+                       size_t align = alignof(std::max_align_t)) {
+    //no lock needed for the system calls. extra alignment is paid for by
+    //mapping `align` more bytes, then unmapping whatever is left over
+    size_t extra = align > alignof(std::max_align_t) ? align : 0;
+    char* map = (char*) MAP_FAILED;
+    size_t len = 0;
+    if (sz <= SIZE_MAX - header_size - 2 * slab_page_size - extra) {
+        len = (header_size + redzone_end(sz) + extra + slab_page_size - 1) & ~(slab_page_size - 1);
+        map = (char*) mmap(nullptr, len, PROT_READ | PROT_WRITE, MAP_ANON | MAP_PRIVATE, -1, 0);
+    }
+    block_header* h = (block_header*) map;
+    if (map != MAP_FAILED && extra) {
+        char* ptr = (char*) (((uintptr_t) map + header_size + align - 1) & ~(align - 1));
+        h = (block_header*) (ptr - header_size);
+        char* lo = big_mapping(h);
+        char* hi = (char*) (((uintptr_t) ptr + redzone_end(sz) + slab_page_size - 1) & ~(slab_page_size - 1));
+        if (lo > map) {
+            munmap(map, lo - map);
+        }
+        if (hi < map + len) {
+            munmap(hi, map + len - hi);
+        }
+        map = lo;
+        len = hi - lo;
+    }
+    std::lock_guard<std::mutex> guard(heap_lock);
+    if (map == MAP_FAILED) {
+        ++gstats.nfail;
+        gstats.fail_size += sz;
+        return nullptr;
+    }
+    set_header(h, map + len - (char*) h, BLOCK_ALLOC | BLOCK_MMAP);
+    h->req = sz;
+    h->site = site_id(file, line);
+    site_alloc(h->site, sz);
+    char* ptr = block_payload(h);
+    redzone_fill(ptr, sz);
+    big_blocks.insert(h);
+    big_mapped_bytes += len;
+    ++gstats.ntotal;
+    ++gstats.nactive;
+    gstats.total_size += sz;
+    gstats.active_size += sz;
+    note_heap_range((uintptr_t) ptr, (uintptr_t) ptr + sz);
+    return ptr;
+}
+
+//the free functions' `sz` when the caller didn't say (m61_free)
+constexpr size_t unsized = SIZE_MAX;
+
+//aborts if m61_free_sized was told the wrong size for ptr
+static void check_free_size(void* ptr, size_t sz, size_t actual, const char* file, int line) {
+    if (sz != unsized && sz != actual) {
+        std::cerr << "MEMORY BUG: "<<file<<":"<<line<<": invalid free of pointer "<< ptr <<" with size "<< sz <<", allocated with size "<< actual <<"\n";
+        abort();
+    }
+}
+
+//returns the live big block whose payload starts at ptr, or nullptr.
+//heap_lock must be held
+static block_header* big_header_of(void* ptr) {
+    auto it = big_blocks.find((block_header*) ((char*) ptr - header_size));
+    return it != big_blocks.end() ? *it : nullptr;
+}
+
+//frees ptr, which isn't in any arena, so it had better be a big block
+//(of sz bytes, unless sz is `unsized`)
+static void big_free(void* ptr, const char* file, int line, size_t sz = unsized) {
+    std::unique_lock<std::mutex> guard(heap_lock);
+    block_header* h = big_header_of(ptr);
+    if (!h) {
+        //inside some big block, or nowhere we ever handed out?
+        auto it = big_blocks.upper_bound((block_header*) ptr);
+        if (it == big_blocks.begin() || (char*) ptr >= (char*) *std::prev(it) + block_size(*std::prev(it))) {
+            std::cerr << "MEMORY BUG: invalid free of pointer "<< ptr <<", not in heap\n";
+            abort();
+        }
+        block_header* c = *std::prev(it);
+        std::cerr << "MEMORY BUG: "<<file<<":"<<line<<": invalid free of pointer "<< ptr <<", not allocated\n";
+        if ((char*) ptr > block_payload(c)) {
+            const site_entry& site = sites[c->site];
+            std::cerr <<site.file<<":"<<site.line<<": "<< ptr <<" is "<< ((uintptr_t)ptr - (uintptr_t)block_payload(c)) <<" bytes inside a "<<c->req<<" byte region allocated here\n";
+        }
+        abort();
+    }
+    check_free_size(ptr, sz, h->req, file, line);
+    if (!redzone_intact((char*) ptr, h->req)) {
+        std::cerr << "MEMORY BUG: "<<file<<":"<<line<<": detected wild write during free of pointer "<< ptr <<"\n";
+        abort();
+    }
+    --gstats.nactive;
+    gstats.active_size -= h->req;
+    site_free(h->site, h->req);
+    big_blocks.erase(h);
+    big_mapped_bytes -= big_mapping_size(h);
+    guard.unlock();
+    munmap(big_mapping(h), big_mapping_size(h));
+}
+
+//sampled allocations (about one in sample_rate, none if 0) go to the guarded
+//pool instead, to catch memory errors as they happen at almost no cost to
+//the rest. each object sits at the end of a page of its own, flush against
+//a PROT_NONE guard page, so overflowing it faults at once, and freeing it
+//makes its page PROT_NONE too, so using it after the free faults until the
+//page is reused (oldest freed first). the fault handler turns the fault
+//into a MEMORY BUG report
+constexpr size_t guard_slots = 256;
+constexpr size_t guard_pool_size = (2 * guard_slots + 1) * os_page_size;
+struct guarded_slot {
+    char* ptr;                          // the object; nullptr if never used
+    size_t size;
+    uint32_t site;
+    bool live;
+    const char* free_file;              // where it was last freed
+    int free_line;
+    unsigned long long free_order;
+};
+//[guard][slot 0][guard][slot 1]...[guard], mapped at the first sample
+static std::atomic<char*> guard_pool;
+static guarded_slot guard_slot_info[guard_slots];
+static unsigned long long guard_nfrees;
+static struct sigaction guard_old_action;
+
+static unsigned initial_sample_rate() {
+    const char* env = getenv("M61_SAMPLE_RATE");
+    return env ? strtoul(env, nullptr, 0) : 0;
+}
+static std::atomic<unsigned> sample_rate{initial_sample_rate()};
+
+static bool in_guard_pool(const void* ptr) {
+    char* pool = guard_pool.load(std::memory_order_acquire);
+    return pool && (char*) ptr >= pool && (char*) ptr < pool + guard_pool_size;
+}
+
+static char* guard_slot_page(size_t i) {
+    return guard_pool.load(std::memory_order_relaxed) + (2 * i + 1) * os_page_size;
+}
+
+//the live sampled object at ptr, or nullptr
+static guarded_slot* guarded_lookup(void* ptr) {
+    size_t page = ((char*) ptr - guard_pool.load(std::memory_order_relaxed)) / os_page_size;
+    guarded_slot* slot = &guard_slot_info[page / 2];
+    return page % 2 == 1 && slot->ptr == ptr && slot->live ? slot : nullptr;
+}
+
+//the fault handler: a fault in the pool is a memory error in a sampled
+//object; anything else goes to whoever handled SIGSEGV before us
+static void guard_fault(int, siginfo_t* si, void* context) {
+    char* addr = (char*) si->si_addr;
+    if (!in_guard_pool(addr)) {
+        //put the old handler back; the access faults again and reaches it
+        sigaction(SIGSEGV, &guard_old_action, nullptr);
+        return;
+    }
+    const char* what = "access to";
+#if defined(__x86_64__) && defined(REG_ERR)
+    //page fault error code bit 1: the access was a write
+    what = ((ucontext_t*) context)->uc_mcontext.gregs[REG_ERR] & 2 ? "write to" : "read of";
+#else
+    (void) context;
+#endif
+    char buf[512];
+    int n;
+    size_t page = (addr - guard_pool.load(std::memory_order_relaxed)) / os_page_size;
+    if (page % 2 == 1) {
+        guarded_slot& slot = guard_slot_info[page / 2];
+        const site_entry& site = sites[slot.site];
+        n = snprintf(buf, sizeof(buf), "MEMORY BUG: %s:%d: invalid %s %p after free, %zd bytes into a %zu byte region freed here\n"
+                     "%s:%d: the region was allocated here\n",
+                     slot.free_file, slot.free_line, what, addr, addr - slot.ptr, slot.size,
+                     site.file, site.line);
+    } else {
+        //a guard page: blame the live object just before it, unless the
+        //access is nearer the live one after it (or there is none before
+        //it). The last guard page has no slot after it.
+        size_t before = page / 2 - 1, after = page / 2;
+        bool live_before = page > 0 && guard_slot_info[before].live;
+        bool live_after = after < guard_slots && guard_slot_info[after].live;
+        bool overflow = live_before
+            && ((size_t) (addr - guard_pool.load(std::memory_order_relaxed)) % os_page_size < os_page_size / 2
+                || !live_after);
+        if (!live_before && !live_after) {
+            n = snprintf(buf, sizeof(buf), "MEMORY BUG: invalid %s %p, a wild pointer into a guard page\n",
+                         what, addr);
+        } else {
+            guarded_slot& slot = guard_slot_info[overflow ? before : after];
+            const site_entry& site = sites[slot.site];
+            if (overflow) {
+                n = snprintf(buf, sizeof(buf), "MEMORY BUG: %s:%d: invalid %s %p, %zd bytes past the end of a %zu byte region allocated here\n",
+                             site.file, site.line, what, addr, addr - (slot.ptr + slot.size), slot.size);
+            } else {
+                n = snprintf(buf, sizeof(buf), "MEMORY BUG: %s:%d: invalid %s %p, %zd bytes before a %zu byte region allocated here\n",
+                             site.file, site.line, what, addr, slot.ptr - addr, slot.size);
+            }
+        }
+    }
+    //(no iostreams in a signal handler)
+    if (write(STDERR_FILENO, buf, std::min(n, (int) sizeof(buf) - 1)) < 0) {
+    }
+    abort();
+}
+
+//places a sampled allocation in the guarded pool; returns nullptr if the
+//pool is full (or can't be mapped) and sz should be allocated normally.
+//heap_lock must be held
+static void* guarded_alloc(size_t sz, uint32_t site) {
+    char* pool = guard_pool.load(std::memory_order_relaxed);
+    if (!pool) {
+        pool = (char*) mmap(nullptr, guard_pool_size, PROT_NONE, MAP_ANON | MAP_PRIVATE, -1, 0);
+        if (pool == MAP_FAILED) {
+            return nullptr;
+        }
+        struct sigaction sa = {};
+        sa.sa_sigaction = guard_fault;
+        sa.sa_flags = SA_SIGINFO;
+        sigemptyset(&sa.sa_mask);
+        sigaction(SIGSEGV, &sa, &guard_old_action);
+        guard_pool.store(pool, std::memory_order_release);
+    }
+    //a never-used slot, else the one freed longest ago
+    guarded_slot* slot = nullptr;
+    for (size_t i = 0; i != guard_slots; ++i) {
+        guarded_slot* s = &guard_slot_info[i];
+        if (!s->ptr) {
+            s->ptr = guard_slot_page(i);
+            slot = s;
+            break;
+        } else if (!s->live && (!slot || s->free_order < slot->free_order)) {
+            slot = s;
+        }
+    }
+    if (!slot) {
+        return nullptr;
+    }
+    char* page = guard_slot_page(slot - guard_slot_info);
+    if (mprotect(page, os_page_size, PROT_READ | PROT_WRITE) != 0) {
+        return nullptr;
+    }
+    //as far right as alignment allows; the slack after it must stay intact
+    char* ptr = (char*) ((uintptr_t) (page + os_page_size - std::max(sz, size_t(1)))
+                         & ~(alignof(std::max_align_t) - 1));
+    memset(ptr + sz, 61, page + os_page_size - (ptr + sz));
+    *slot = {ptr, sz, site, true, nullptr, 0, 0};
+    site_alloc(site, sz);
+    ++gstats.ntotal;
+    ++gstats.nactive;
+    gstats.total_size += sz;
+    gstats.active_size += sz;
+    note_heap_range((uintptr_t) ptr, (uintptr_t) ptr + sz);
+    return ptr;
+}
+
+//should this thread's next allocation be sampled? also draws how many
+//allocations until the next one, averaging sample_rate
+static bool sample_due(thread_cache& tc) {
+    unsigned rate = sample_rate.load(std::memory_order_relaxed);
+    if (rate == 0 || --tc.sample_countdown > 0) {
+        return false;
+    }
+    if (tc.sample_random == 0) {
+        tc.sample_random = (uintptr_t) &tc | 1;
+    }
+    tc.sample_random ^= tc.sample_random << 13;
+    tc.sample_random ^= tc.sample_random >> 7;
+    tc.sample_random ^= tc.sample_random << 17;
+    tc.sample_countdown = 1 + tc.sample_random % (2 * (uint64_t) rate - 1);
+    return true;
+}
+
+//heap_lock must be held
+static void guarded_free(void* ptr, const char* file, int line, size_t sz = unsized) {
+    guarded_slot* slot = guarded_lookup(ptr);
+    if (!slot) {
+        size_t page = ((char*) ptr - guard_pool.load(std::memory_order_relaxed)) / os_page_size;
+        guarded_slot& s = guard_slot_info[page / 2];
+        if (page % 2 == 1 && s.ptr == ptr) {
+            std::cerr << "MEMORY BUG: "<<file<<":"<<line<<": invalid free of pointer "<< ptr <<", double free\n";
+            abort();
+        }
+        std::cerr << "MEMORY BUG: "<<file<<":"<<line<<": invalid free of pointer "<< ptr <<", not allocated\n";
+        if (page % 2 == 1 && s.live && (char*) ptr > s.ptr && (char*) ptr < s.ptr + s.size) {
+            const site_entry& site = sites[s.site];
+            std::cerr <<site.file<<":"<<site.line<<": "<< ptr <<" is "<< ((char*) ptr - s.ptr) <<" bytes inside a "<<s.size<<" byte region allocated here\n";
+        }
+        abort();
+    }
+    check_free_size(ptr, sz, slot->size, file, line);
+    char* end = (char*) ((uintptr_t) slot->ptr | (os_page_size - 1)) + 1;
+    for (char* p = slot->ptr + slot->size; p != end; ++p) {
+        if (*p != 61) {
+            std::cerr << "MEMORY BUG: "<<file<<":"<<line<<": detected wild write during free of pointer "<< ptr <<"\n";
+            abort();
+        }
+    }
+    --gstats.nactive;
+    gstats.active_size -= slot->size;
+    site_free(slot->site, slot->size);
+    slot->live = false;
+    slot->free_file = file;
+    slot->free_line = line;
+    slot->free_order = ++guard_nfrees;
+    mprotect(end - os_page_size, os_page_size, PROT_NONE);
+}
+
+//takes an object of size sz (<= slab_max_object) from the thread cache, refilling it
+//if it's empty. returns nullptr if the slab pages are out of room
+static void* tcache_alloc(thread_cache& tc, size_t sz, uint32_t site) {
+    int c = slab_class(sz);
+    if (tc.count[c] == 0) {
+        tcache_refill(tc, c);
+        if (tc.count[c] == 0) {
+            return nullptr;
+        }
+    }
+    char* ptr = tc.slots[c][--tc.count[c]];
+    slab_page* sp = slab_lookup(ptr);
+    size_t slot = slab_slot(sp, ptr);
+    slab_sizes(sp)[slot] = sz;
+    redzone_fill(ptr, sz);
+    //(the heap scanner may be looking at this slot without our lock: the
+    //site says it's live, so it goes last)
+    std::atomic_ref<uint32_t>(slab_sites(sp)[slot]).store(site, std::memory_order_release);
+    site_alloc(site, sz);
+    if (!in_heap_bounds(ptr) || !in_heap_bounds(ptr + sz)) {
+        std::lock_guard<std::mutex> guard(heap_lock);
+        note_heap_range((uintptr_t) ptr, (uintptr_t) ptr + sz);
+    }
+    bump(tc.ntotal, 1);
+    bump(tc.total_size, sz);
+    bump(tc.nactive, 1);
+    bump(tc.active_size, sz);
+    return ptr;
+}
+
+//allocates a small object for site from site pool `pool`'s slab pages.
+//heap_lock must be held
+static void* pool_slab_alloc(size_t sz, uint32_t site, int pool) {
+    char* ptr = slab_take(slab_class(sz), pool + 1);
+    if (!ptr) {
+        return nullptr;
+    }
+    slab_page* sp = slab_lookup(ptr);
+    size_t slot = slab_slot(sp, ptr);
+    slab_sites(sp)[slot] = site;
+    slab_sizes(sp)[slot] = sz;
+    site_alloc(site, sz);
+    redzone_fill(ptr, sz);
+    ++gstats.ntotal;
+    ++gstats.nactive;
+    gstats.total_size += sz;
+    gstats.active_size += sz;
+    note_heap_range((uintptr_t) ptr, (uintptr_t) ptr + sz);
+    return ptr;
+}
+
+//allocates sz bytes (< mmap_threshold, unless the heap is persistent) as a
+//block of its own in an arena, growing the heap if needed. heap_lock must be
+//held. if `clean` is given, it gets two spans of memory known to read as zero
+//(for m61_calloc). payloads aligned past 16 bytes are carved out of the middle
+//of a free block, and the part in front of them goes back to the bins
+static void* general_alloc(thread_cache& tc, size_t sz, uint32_t site, page_span* clean = nullptr,
+                           size_t align = alignof(std::max_align_t)) {
+    size_t alignment = alignof(std::max_align_t);
+    void* fptr = nullptr; //inital assignment of fptr, will get changed if suitable address is found, otherwise will be returned as null
+    size_t needed = header_size + redzone_end(sz);
+    //a block this big has an aligned payload with room for a free block in front
+    size_t search = align > alignment ? needed + align + min_block : needed;
+    //a hot site's object goes at the front of its pool's cursor block, or of
+    //a new one big enough for more objects after it
+    int pool = align > alignment ? -1 : site_pool_of(site);
+    block_header* h = nullptr;
+    if (pool >= 0) {
+        h = site_cursors[pool];
+        if (!h || block_size(h) < needed) {
+            h = find_free_block(std::max(needed, site_chunk_size));
+        }
+    }
+    if (!h) {
+        h = find_free_block(search);
+    }
+    if (!h) {
+        //out of room: give back what this thread has parked and any empty slab pages
+        tcache_flush(tc);
+        if (slab_release_empty()) {
+            h = find_free_block(search);
+        }
+    }
+    if (!h && search <= arena_size - header_size && add_arena()) {
+        //a fresh arena is one free block, much bigger than anything that
+        //doesn't go to big_alloc (except in a persistent heap)
+        h = find_free_block(search);
+    }
+    if (h) {
+        if (clean) {
+            //everything outside the dirty span; carving only writes headers
+            //and footers, which are never in the new block's payload
+            page_span inner = inner_pages(h, block_size(h));
+            page_span dirty = dirty_pages(h);
+            clean[0] = {inner.lo, dirty.lo};
+            clean[1] = {dirty.hi, inner.hi};
+        }
+        size_t off = 0;
+        uint64_t tag = free_tag(h);
+        if (align > alignment) {
+            uintptr_t payload = ((uintptr_t) h + header_size + align - 1) & ~(align - 1);
+            off = payload - header_size - (uintptr_t) h;
+            while (off > 0 && off < min_block) {
+                off += align;
+            }
+        } else if (tag && tag != uint64_t(pool + 1) && block_size(h) - needed >= min_block) {
+            //another site's cursor: leave it the front
+            off = block_size(h) - needed;
+        }
+        block_header* cursor = h;
+        h = free_carve(h, off, needed);
+        if (off > 0 && tag) {
+            //the front is still free, and still the same pool's cursor
+            set_site_cursor(tag - 1, cursor);
+        } else if (pool >= 0 && off == 0) {
+            block_header* rest = block_next(h);
+            set_site_cursor(pool, rest->size & BLOCK_ALLOC ? nullptr : rest);
+        }
+        set_header(h, block_size(h), (h->size & BLOCK_PREV_FREE) | BLOCK_ALLOC);
+        h->req = sz;
+        h->site = site;
+        site_alloc(h->site, sz);
+        fptr = block_payload(h);
+        redzone_fill((char*) fptr, sz);
+    }
+
+    if (fptr != nullptr) {
+        //statistics
+        ++gstats.ntotal;
+        note_heap_range((uintptr_t) fptr, (uintptr_t) fptr + sz);
+        ++gstats.nactive;
+        gstats.total_size += sz;
+        gstats.active_size += sz;
+        return fptr;
+    }
+    ++gstats.nfail;
+    gstats.fail_size += sz;
+    return nullptr;
+}
+
+
+//with M61_TRACE=FILE in the environment, every allocation and free made
+//through the public functions is appended to FILE as m61_trace_events, for
+//m61replay to run again later. objects get ids in allocation order; a site
+//is described by an M61_TRACE_SITE event before its first use. the tracer's
+//own memory comes from the system allocator
+struct m61_tracer {
+    int fd = -1;
+    std::mutex lock;
+    std::unordered_map<void*, uint64_t> ids;            // live objects
+    std::map<std::pair<const char*, int>, uint32_t> sites;
+    uint64_t next_id = 1;
+    static constexpr size_t bufcap = 512;
+    m61_trace_event buf[bufcap];
+    size_t n = 0;
+
+    m61_tracer() {
+        const char* path = getenv("M61_TRACE");
+        if (path && *path) {
+            fd = open(path, O_WRONLY | O_CREAT | O_TRUNC | O_CLOEXEC, 0666);
+        }
+    }
+    ~m61_tracer() {
+        if (fd >= 0) {
+            std::lock_guard<std::mutex> guard(lock);
+            flush();
+            close(fd);
+            fd = -1;
+        }
+    }
+    void flush() {
+        const char* p = (const char*) buf;
+        size_t left = n * sizeof(m61_trace_event);
+        while (left > 0) {
+            ssize_t w = write(fd, p, left);
+            if (w < 0) {
+                break;
+            }
+            p += w;
+            left -= w;
+        }
+        n = 0;
+    }
+    void add(const m61_trace_event& e) {
+        if (n == bufcap) {
+            flush();
+        }
+        buf[n++] = e;
+    }
+    uint32_t site(const char* file, int line) {
+        auto [it, inserted] = sites.try_emplace({file, line}, sites.size() + 1);
+        if (inserted) {
+            //the name follows in as many events' worth of bytes as it takes
+            size_t len = strlen(file);
+            add({M61_TRACE_SITE, {}, it->second, (uint64_t) line, 0, len});
+            for (size_t off = 0; off < len; off += sizeof(m61_trace_event)) {
+                m61_trace_event name = {};
+                memcpy(&name, file + off, std::min(len - off, sizeof(name)));
+                add(name);
+            }
+        }
+        return it->second;
+    }
+};
+static m61_tracer tracer;
+static thread_local int trace_depth;    // > 0 inside a traced call
+
+//should this call be traced? calls made by other m61 functions are not
+static bool tracing() {
+    return tracer.fd >= 0 && trace_depth == 0;
+}
+
+//turns tracing off for this thread while it lives
+struct trace_pause {
+    trace_pause() {
+        ++trace_depth;
+    }
+    ~trace_pause() {
+        --trace_depth;
+    }
+};
+
+//records that `ptr` was freed, before it is, so no other thread's event
+//about an object reusing its address can come first
+static void trace_free(void* ptr, const char* file, int line) {
+    if (!ptr) {
+        return;
+    }
+    std::lock_guard<std::mutex> guard(tracer.lock);
+    uint64_t id = 0;                    // never allocated as far as we know
+    if (auto it = tracer.ids.find(ptr); it != tracer.ids.end()) {
+        id = it->second;
+        tracer.ids.erase(it);
+    }
+    tracer.add({M61_TRACE_FREE, {}, tracer.site(file, line), 0, id, 0});
+}
+
+//records an allocation (or for M61_TRACE_REALLOC, a resize of object
+//`arg` that was already taken out of the live objects) that returned ptr
+static void trace_alloc(uint8_t op, const char* file, int line, size_t sz,
+                        void* ptr, uint64_t arg = 0) {
+    std::lock_guard<std::mutex> guard(tracer.lock);
+    uint64_t id = 0;                    // failed
+    if (ptr) {
+        id = tracer.next_id++;
+        tracer.ids[ptr] = id;
+    }
+    tracer.add({op, {}, tracer.site(file, line), sz, id, arg});
+}
+
+//takes ptr's id out of the live objects for a realloc
+static uint64_t trace_take_id(void* ptr) {
+    std::lock_guard<std::mutex> guard(tracer.lock);
+    auto it = tracer.ids.find(ptr);
+    if (!ptr || it == tracer.ids.end()) {
+        return 0;
+    }
+    uint64_t id = it->second;
+    tracer.ids.erase(it);
+    return id;
+}
+
+//puts it back if the realloc failed
+static void trace_restore_id(void* ptr, uint64_t id) {
+    if (ptr && id) {
+        std::lock_guard<std::mutex> guard(tracer.lock);
+        tracer.ids[ptr] = id;
+    }
+}
+
+//the heap scanner checks live objects' red zones, and every block header, a
+//few blocks at a time: one step every scan_interval calls to m61_malloc and
+//m61_free (or never, if 0), made by whichever thread's turn it is. the hot
+//paths only fill the red zones; this is what finds an overflow in an object
+//that lives on, or that the program never frees. m61_check_heap checks
+//everything at once
+constexpr int scan_budget = 16;             // blocks per step; a slab page is one
+static int scan_arena = -1;                 // the arena scan_cursor is in
+
+static unsigned initial_scan_interval() {
+    const char* env = getenv("M61_SCAN_INTERVAL");
+    return env ? strtoul(env, nullptr, 0) : 0;
+}
+static std::atomic<unsigned> scan_interval{initial_scan_interval()};
+
+//is it this thread's turn to take a scanner step?
+static bool scan_due(thread_cache& tc) {
+    unsigned interval = scan_interval.load(std::memory_order_relaxed);
+    if (interval == 0 || --tc.scan_countdown > 0) {
+        return false;
+    }
+    tc.scan_countdown = interval;
+    return true;
+}
+
+[[noreturn]] static void scan_report_redzone(void* ptr, size_t sz, uint32_t site) {
+    const site_entry& s = sites[site];
+    std::cerr << "MEMORY BUG: "<<s.file<<":"<<s.line<<": detected wild write past the end of pointer "<< ptr <<", a "<< sz <<" byte region allocated here\n";
+    abort();
+}
+
+//reports damaged metadata at addr. if that's the header of block h, also
+//reports the live object just before h, which probably ran over it
+[[noreturn]] static void scan_report_metadata(m61_memory_buffer* a, block_header* h, void* addr) {
+    std::cerr << "MEMORY BUG: detected wild write over heap metadata at "<< addr <<"\n";
+    if (!h) {
+        abort();
+    }
+    block_header* prev = (block_header*) a->buffer;
+    while (prev != h && block_next(prev) != h && block_size(prev) != 0) {
+        prev = block_next(prev);
+    }
+    if (prev != h && (prev->size & BLOCK_ALLOC) && !(prev->size & BLOCK_SLAB)) {
+        const site_entry& s = sites[prev->site];
+        char* end = block_payload(prev) + prev->req;
+        std::cerr <<s.file<<":"<<s.line<<": "<< addr <<" is "<< (char*) addr - end <<" bytes past the end of a "<< prev->req <<" byte region allocated here\n";
+    }
+    abort();
+}
+
+//redzone_intact for a slab object that a thread cache may be handing out or
+//taking back: the red zone is copied with acquire loads, so the caller's
+//second look at the slot's site and size comes after it
+static bool redzone_intact_acquire(const char* ptr, size_t sz) {
+    size_t base = sz & ~size_t(15);
+    alignas(16) char copy[32];
+    for (size_t off = 0; off != redzone_end(sz) - base; off += sizeof(uint64_t)) {
+        uint64_t word = std::atomic_ref<uint64_t>(*(uint64_t*) (ptr + base + off))
+            .load(std::memory_order_acquire);
+        memcpy(copy + off, &word, sizeof(word));
+    }
+    return redzone_intact(copy, sz - base);
+}
+
+//checks the live objects in slab page sp. thread caches hand out and take
+//back slots without heap_lock, so a slot's site and size are read
+//atomically, and a bad red zone only counts if the slot stayed the same
+//object throughout
+static void scan_slab(slab_page* sp) {
+    for (size_t w = 0; w != 4; ++w) {
+        for (uint64_t bits = load_bits(sp->used[w]); bits; bits &= bits - 1) {
+            size_t slot = w * 64 + __builtin_ctzll(bits);
+            std::atomic_ref<uint32_t> site(slab_sites(sp)[slot]);
+            std::atomic_ref<uint8_t> size(slab_sizes(sp)[slot]);
+            uint32_t s = site.load(std::memory_order_acquire);
+            size_t sz = size.load(std::memory_order_relaxed);
+            char* ptr = slab_slots(sp) + slot * sp->slot_size;
+            if (s == slab_cached || redzone_end(sz) > sp->slot_size || redzone_intact(ptr, sz)) {
+                continue;
+            }
+            if (!redzone_intact_acquire(ptr, sz)
+                && site.load(std::memory_order_relaxed) == s
+                && size.load(std::memory_order_relaxed) == sz) {
+                scan_report_redzone(ptr, sz, s);
+            }
+        }
+    }
+}
+
+//checks block h of arena a: its header, and its objects' red zones or (if
+//it's free) its footer. heap_lock must be held
+static void scan_block(m61_memory_buffer* a, block_header* h) {
+    if (h->check != header_check(h)
+        || (char*) h + block_size(h) > a->buffer + a->size - header_size
+        || (block_size(h) == 0 && (char*) h != a->buffer + a->size - header_size)) {
+        scan_report_metadata(a, h, h);
+    }
+    if (h->size & BLOCK_SLAB) {
+        scan_slab(slab_of_block(h));
+    } else if (h->size & BLOCK_ALLOC) {
+        if (block_size(h) != 0 && !redzone_intact(block_payload(h), h->req)) {
+            scan_report_redzone(block_payload(h), h->req, h->site);
+        }
+    } else {
+        size_t* footer = (size_t*) ((char*) block_next(h) - sizeof(size_t));
+        if (*footer != block_size(h)) {
+            scan_report_metadata(a, nullptr, footer);
+        }
+    }
+}
+
+static void scan_big_blocks() {
+    for (block_header* h : big_blocks) {
+        if (!redzone_intact(block_payload(h), h->req)) {
+            scan_report_redzone(block_payload(h), h->req, h->site);
+        }
+    }
+}
+
+//checks the next scan_budget blocks, going round the arenas in turn, and
+//the big blocks after each round. heap_lock must be held
+static void scan_step() {
+    int n = narenas.load(std::memory_order_relaxed);
+    for (int budget = scan_budget; budget > 0; --budget) {
+        if (!scan_cursor) {
+            if (++scan_arena >= n) {
+                scan_arena = 0;
+                scan_big_blocks();
+            }
+            scan_cursor = (block_header*) arenas[scan_arena]->buffer;
+        }
+        m61_memory_buffer* a = arenas[scan_arena];
+        scan_block(a, scan_cursor);
+        scan_cursor = block_size(scan_cursor) == 0 ? nullptr : block_next(scan_cursor);
+    }
+}
+
+/// m61_malloc(sz, file, line)
+///    Returns a pointer to `sz` bytes of freshly-allocated dynamic memory.
+///    The memory is not initialized. If `sz == 0`, then m61_malloc may
+///    return either `nullptr` or a pointer to a unique allocation.
+///    The allocation request was made at source code location `file`:`line`.
+
+void* m61_malloc(size_t sz, const char* file, int line) {
+    (void) file, (void) line;   // avoid uninitialized variable warnings
+    if (tracing()) {
+        void* ptr;
+        {
+            trace_pause pause;
+            ptr = m61_malloc(sz, file, line);
+        }
+        trace_alloc(M61_TRACE_MALLOC, file, line, sz, ptr);
+        return ptr;
+    }
+
+    //(touch the thread cache before taking the lock: creating it locks too)
+    thread_cache& tc = tcache;
+    if (scan_due(tc)) {
+        std::lock_guard<std::mutex> guard(heap_lock);
+        scan_step();
+    }
+    if (sz <= os_page_size && sample_due(tc)) {
+        std::lock_guard<std::mutex> guard(heap_lock);
+        if (void* ptr = guarded_alloc(sz, site_id(file, line))) {
+            return ptr;
+        }
+    }
+    //small objects come out of this thread's cache without taking the lock
+    //(or out of their site's pool)
+    if (sz <= slab_max_object) {
+        uint32_t site = tcache_site(tc, file, line);
+        if (site_hot(site)) {
+            std::lock_guard<std::mutex> guard(heap_lock);
+            int pool = site_pool_of(site);
+            if (void* ptr = pool >= 0 ? pool_slab_alloc(sz, site, pool) : nullptr) {
+                return ptr;
+            }
+        }
+        if (void* ptr = tcache_alloc(tc, sz, site)) {
+            return ptr;
+        }
+    }
+
+    if (wants_mapping(sz)) {
+        return big_alloc(sz, file, line);
+    }
 
-/// m61_malloc(sz, file, line)
-///    Returns a pointer to `sz` bytes of freshly-allocated dynamic memory.
-///    The memory is not initialized. If `sz == 0`, then m61_malloc may
-///    return either `nullptr` or a pointer to a unique allocation.
-///    The allocation request was made at source code location `file`:`line`.
+    std::lock_guard<std::mutex> guard(heap_lock);
+    return general_alloc(tc, sz, site_id(file, line));
+}
 
-void* m61_malloc(size_t sz, const char* file, int line) {
-    (void) file, (void) line;   // avoid uninitialized variable warnings
+/// m61_aligned_alloc(align, sz, file, line)
+///    Returns a pointer to `sz` bytes of uninitialized dynamic memory whose
+///    address is a multiple of `align`, or `nullptr` if `align` is not a
+///    power of two or the allocation fails. The result is an ordinary
+///    block: m61_free, m61_realloc and the leak report treat it like any
+///    other. At most `align` extra bytes are used to get the alignment, and
+///    those go back to the free bins or the kernel.
 
-    //checking if sz is larger than buffer can handle
-    if (sz == SIZE_MAX || sz >= default_buffer.size) {
+void* m61_aligned_alloc(size_t align, size_t sz, const char* file, int line) {
+    if (tracing()) {
+        void* ptr;
+        {
+            trace_pause pause;
+            ptr = m61_aligned_alloc(align, sz, file, line);
+        }
+        trace_alloc(M61_TRACE_ALIGNED_ALLOC, file, line, sz, ptr, align);
+        return ptr;
+    }
+    if (align == 0 || (align & (align - 1)) != 0) {
+        std::lock_guard<std::mutex> guard(heap_lock);
         ++gstats.nfail;
         gstats.fail_size += sz;
         return nullptr;
     }
-
-    size_t alignment = alignof(std::max_align_t);
-    void* fptr = nullptr; //inital assignment of fptr, will get changed if suitable address is found, otherwise will be returned as null
-    size_t padding = (alignment - (sz % alignment));
-    if (padding == 0) { //if no more space to add magic footer to store value for checking buffer overwrite
-        padding = (alignment - ((sz+1) % alignment));
-    }
-    for (auto it = freed_addresses.begin(); it!=freed_addresses.end(); ++it){
-        if (it->second >= (sz + padding)) {
-            fptr =  it->first;
-            size_t o_size = it->second;
-            size_t size_left = o_size - (sz + padding);
-            if (size_left > 0) {
-                void* nptr = (void*)((uintptr_t)fptr + sz + padding);
-                freed_addresses.insert ({nptr,size_left});
-            }
-            freed_addresses.erase(it);
-            
-            active_addresses.insert ({fptr, {sz, padding, file, line}});
-            char* magicptr = (char*)((uintptr_t)fptr + sz);
-            *magicptr = 61;
-            break;
-        }
+    //every allocation is already 16-byte aligned. slab slots are only
+    //aligned to their size class, so bigger alignments skip the slabs
+    if (align <= alignof(std::max_align_t)) {
+        return m61_malloc(sz, file, line);
+    }
+    if (wants_mapping(sz) || wants_mapping(align)) {
+        return big_alloc(sz, file, line, align);
     }
+    thread_cache& tc = tcache;
+    std::lock_guard<std::mutex> guard(heap_lock);
+    return general_alloc(tc, sz, site_id(file, line), nullptr, align);
+}
 
-    if (fptr != nullptr) {
-        //statistics
-        ++gstats.ntotal;
-        if (gstats.ntotal == 1) { //if first use of heap, then set min
-            gstats.heap_min = (uintptr_t) fptr;}
-        if (gstats.heap_min > (uintptr_t) fptr) {
-            gstats.heap_min = (uintptr_t) fptr;}
-        if (gstats.heap_max < ((uintptr_t) fptr) + sz) {
-            gstats.heap_max = (uintptr_t) (fptr) + sz;
-        }
-        ++gstats.nactive;
-        gstats.total_size += sz;
-        gstats.active_size += sz;
-        //assertion just to make sure
-        assert(fptr != nullptr);
-        return fptr;
+/// m61_posix_memalign(ptr, align, sz, file, line)
+///    Like m61_aligned_alloc, but returns the allocation in `*ptr` and an
+///    error code: 0 on success, EINVAL if `align` is not a power of two
+///    multiple of `sizeof(void*)` (then `*ptr` is unchanged), ENOMEM if the
+///    allocation fails.
+
+int m61_posix_memalign(void** ptr, size_t align, size_t sz, const char* file, int line) {
+    if (align == 0 || align % sizeof(void*) != 0 || (align & (align - 1)) != 0) {
+        return EINVAL;
     }
-    ++gstats.nfail;
-    gstats.fail_size += sz;
-    return nullptr;
+    void* p = m61_aligned_alloc(align, sz, file, line);
+    if (!p) {
+        return ENOMEM;
+    }
+    *ptr = p;
+    return 0;
 }
 
 //THE DESCRIPTION FROM PSET DESCRIPTION
@@ -137,7 +2103,20 @@ void* m61_malloc(size_t sz, const char* file, int line) {
 
 void* m61_realloc(void* ptr, size_t sz, const char* file, int line)
 {
-    (void)file, (void)line; 
+    (void)file, (void)line;
+    if (tracing()) {
+        uint64_t id = trace_take_id(ptr);
+        void* nptr;
+        {
+            trace_pause pause;
+            nptr = m61_realloc(ptr, sz, file, line);
+        }
+        if (!nptr && sz != 0) {
+            trace_restore_id(ptr, id);
+        }
+        trace_alloc(M61_TRACE_REALLOC, file, line, sz, nptr, id);
+        return nptr;
+    }
     if (sz == 0) { //nothing to realloc but we free
         m61_free(ptr, file, line);
         return nullptr;
@@ -145,50 +2124,206 @@ void* m61_realloc(void* ptr, size_t sz, const char* file, int line)
     if (ptr == nullptr) { //just mallocing in this case.
         return m61_malloc(sz, file, line);
     }
-    auto it = active_addresses.find(ptr);
-    if (it != active_addresses.end()) {
-        size_t old_size = it->second.actual_size + it->second.padding_size;
-        size_t alignment = alignof(std::max_align_t);
-        size_t padding = (alignment - (sz % alignment)); //same as what i did for malloc
-        if (padding == 0) { //if no more space to add magic footer to store value for checking buffer overwrite
-            padding = (alignment - ((sz+1) % alignment));
-        }
-        size_t new_aligned_sz = sz + padding; //new size with everything included
-        if (new_aligned_sz <= old_size) {
-            it->second.actual_size = sz;
-            it->second.padding_size = padding;
-            // if extra space, add to free addr.
-            size_t diff = old_size - new_aligned_sz;
-            if (diff > 0) {
-                void* newptr = (void*)((char*)ptr + new_aligned_sz);
-                freed_addresses.insert ({newptr, diff});
-                char* magicptr = (char*)((uintptr_t)ptr + sz);
-                *magicptr = 61; //setting the magicptr at new location IF THE NEW ALLOCATION IS SMALLER
-            }
-            //so in this case, new active size is actually lesser
-            gstats.active_size += (new_aligned_sz - old_size);
-            return ptr;
-        }
-
-        // making it bigger, so we have to basically just treat it as a new malloc
-        else {
-            // mallocing
-            void* nptr = m61_malloc(sz, file, line);
-            if (nptr) {
-                m61_free(ptr, file, line); //we free the original thing
-                memcpy(nptr, ptr, sz);
+    size_t old_sz;
+    {
+        std::lock_guard<std::mutex> guard(heap_lock);
+        if (in_guard_pool(ptr)) {
+            //sampled objects always move, which may or may not sample the new one
+            guarded_slot* slot = guarded_lookup(ptr);
+            if (!slot) {
+                fprintf(stderr, "MEMORY BUG: %s:%d: invalid realloc of pointer %p, not allocated\n", file, line, ptr);
+                abort();
+            }
+            old_sz = slot->size;
+        } else if (slab_page* sp = slab_lookup(ptr)) {
+            ssize_t slot = slab_slot(sp, ptr);
+            if (slot < 0 || !slab_used(sp, slot) || slab_sites(sp)[slot] == slab_cached) {
+                fprintf(stderr, "MEMORY BUG: %s:%d: invalid realloc of pointer %p, not allocated\n", file, line, ptr);
+                abort();
+            }
+            old_sz = slab_sizes(sp)[slot];
+            if (sz <= slab_max_object && redzone_end(sz) <= sp->slot_size) { //still fits in the slot with its red zone
+                site_resize(slab_sites(sp)[slot], old_sz, sz);
+                slab_sizes(sp)[slot] = sz;
+                redzone_fill((char*) ptr, sz);
+                gstats.active_size = gstats.active_size - old_sz + sz;
+                return ptr;
+            }
+        } else if (!arena_of(ptr)) {
+            block_header* h = big_header_of(ptr);
+            if (!h) {
+                fprintf(stderr, "MEMORY BUG: %s:%d: invalid realloc of pointer %p, not allocated\n", file, line, ptr);
+                abort();
+            }
+            old_sz = h->req;
+            //big blocks are whole pages, so let the kernel resize the
+            //mapping (moving page table entries, not bytes) instead of copying
+            //(the header keeps its offset into the first page)
+            char* old_map = big_mapping(h);
+            size_t off = (char*) h - old_map;
+            size_t old_len = big_mapping_size(h);
+            size_t new_len = (off + header_size + redzone_end(sz) + slab_page_size - 1) & ~(slab_page_size - 1);
+            void* map = MAP_FAILED;
+            if (sz <= SIZE_MAX - header_size - 2 * slab_page_size) {
+                map = new_len == old_len ? old_map : mremap(old_map, old_len, new_len, MREMAP_MAYMOVE);
+            }
+            if (map != MAP_FAILED) {
+                big_blocks.erase(h);
+                big_mapped_bytes += new_len - old_len;
+                h = (block_header*) ((char*) map + off);
+                set_header(h, new_len - off, BLOCK_ALLOC | BLOCK_MMAP);
+                h->req = sz;
+                site_resize(h->site, old_sz, sz);
+                big_blocks.insert(h);
+                char* nptr = block_payload(h);
+                redzone_fill(nptr, sz);
+                note_heap_range((uintptr_t) nptr, (uintptr_t) nptr + sz);
+                gstats.active_size = gstats.active_size - old_sz + sz;
+                return nptr;
+            }
+        } else {
+            block_header* h = header_of(ptr);
+            if (!h || (h->size & (BLOCK_ALLOC | BLOCK_SLAB)) != BLOCK_ALLOC) {
+                // ayy, cannae reallocate sire.
+                fprintf(stderr, "MEMORY BUG: %s:%d: invalid realloc of pointer %p, not allocated\n", file, line, ptr);
+                abort();
+            }
+            old_sz = h->req;
+            //new size with everything included (never fits if sz can't be in an arena)
+            size_t new_size = sz < arena_size ? header_size + redzone_end(sz) : SIZE_MAX;
+            if (new_size <= block_size(h)) {
+                h->req = sz;
+                site_resize(h->site, old_sz, sz);
+                redzone_fill((char*) ptr, sz); //setting the red zone at new location IF THE NEW ALLOCATION IS SMALLER
+                // if enough extra space, give the tail back as a free block
+                size_t diff = block_size(h) - new_size;
+                if (diff >= min_block) {
+                    set_header(h, new_size, h->size & BLOCK_FLAGS);
+                    block_header* rest = block_next(h);
+                    rest->size = 0;
+                    set_header(rest, diff, 0);
+                    free_block_release(rest);
+                }
+                //so in this case, new active size is actually lesser
+                gstats.active_size = gstats.active_size - old_sz + sz;
+                return ptr;
+            }
+            //growing: if the next block is free and big enough, take as much
+            //of it as we need and leave the rest free
+            block_header* next = block_next(h);
+            if (!(next->size & BLOCK_ALLOC) && block_size(h) + block_size(next) >= new_size) {
+                block_header* b = free_carve(next, 0, new_size - block_size(h));
+                scan_forget(b, h);
+                set_header(h, block_size(h) + block_size(b), h->size & BLOCK_FLAGS);
+                h->req = sz;
+                site_resize(h->site, old_sz, sz);
+                redzone_fill((char*) ptr, sz);
+                gstats.active_size = gstats.active_size - old_sz + sz;
+                note_heap_range((uintptr_t) ptr, (uintptr_t) ptr + sz);
+                return ptr;
             }
-            return nptr;
         }
-    } else {
-        // ayy, cannae reallocate sire. 
-        fprintf(stderr, "MEMORY BUG: %s:%d: invalid realloc of pointer %p, not allocated\n", file, line, ptr);
+    }
+
+    // making it bigger, so we have to basically just treat it as a new malloc
+    void* nptr = m61_malloc(sz, file, line);
+    if (nptr) {
+        size_t copied = std::min(old_sz, sz);   // (sampled objects can shrink here)
+        memcpy(nptr, ptr, copied);
+        m61_free(ptr, file, line); //we free the original thing
+        std::lock_guard<std::mutex> guard(heap_lock);
+        gstats.realloc_copied += copied;
+    }
+    return nptr;
+}
+
+
+//explains why ptr can't be freed and aborts. a header with a good check but no
+//BLOCK_ALLOC bit means ptr was a block once and has been freed already, unless
+//that stale header now sits inside someone else's live allocation
+static void report_invalid_free(void* ptr, const char* file, int line) {
+    block_header* h = header_of(ptr);
+    block_header* c = block_containing(ptr);
+    bool inside_live = c && (c->size & BLOCK_ALLOC) && c != h
+        && (char*) ptr > block_payload(c) && (char*) ptr < (char*) block_next(c);
+    if (h && !(h->size & BLOCK_ALLOC) && !inside_live) {
+        std::cerr << "MEMORY BUG: "<<file<<":"<<line<<": invalid free of pointer "<< ptr <<", double free\n";
         abort();
-        return nullptr; 
     }
+    std::cerr << "MEMORY BUG: "<<file<<":"<<line<<": invalid free of pointer "<< ptr <<", not allocated\n";
+    if (inside_live) {
+        const site_entry& site = sites[c->site];
+        std::cerr <<site.file<<":"<<site.line<<": "<< ptr <<" is "<< ((uintptr_t)ptr - (uintptr_t)block_payload(c)) <<" bytes inside a "<<c->req<<" byte region allocated here\n";
+    }
+    abort();
+}
+
+//puts the slab object ptr, from page sp, back in this thread's cache
+static void tcache_free(slab_page* sp, void* ptr, const char* file, int line,
+                        size_t sz = unsized) {
+    ssize_t slot;
+    if (!slab_live(sp, ptr, &slot)) {
+        std::lock_guard<std::mutex> guard(heap_lock);
+        slab_report_invalid_free(sp, ptr, file, line);
+    }
+    check_free_size(ptr, sz, slab_sizes(sp)[slot], file, line);
+    thread_cache& tc = tcache;
+    int c = sp->slot_size / 16 - 1;
+    bump(tc.nactive, -1);
+    bump(tc.active_size, -(unsigned long long) slab_sizes(sp)[slot]);
+    site_free(slab_sites(sp)[slot], slab_sizes(sp)[slot]);
+    std::atomic_ref<uint32_t>(slab_sites(sp)[slot]).store(slab_cached, std::memory_order_relaxed);
+    if (sp->owner) {
+        //site pool slots go straight back to their page
+        std::lock_guard<std::mutex> guard(heap_lock);
+        slab_put(sp, slot);
+        return;
+    }
+    if (tc.count[c] == tcache_max) {
+        std::lock_guard<std::mutex> guard(heap_lock);
+        tcache_drain(tc, c, tcache_batch);
+    }
+    tc.slots[c][tc.count[c]++] = (char*) ptr;
 }
 
+//frees ptr, which is in an arena but not in a slab page. heap_lock must be held
+static void general_free(void* ptr, const char* file, int line, size_t sz = unsized) {
+    //check that ptr has a header saying it is an active allocation
+    block_header* h = header_of(ptr);
+    if (!h || (h->size & (BLOCK_ALLOC | BLOCK_SLAB)) != BLOCK_ALLOC) {
+        //(m61_free_sized doesn't look for slab objects given big sizes)
+        ssize_t slot;
+        slab_page* sp = sz != unsized ? slab_lookup(ptr) : nullptr;
+        if (sp && slab_live(sp, ptr, &slot)) {
+            check_free_size(ptr, sz, slab_sizes(sp)[slot], file, line);
+        }
+        report_invalid_free(ptr, file, line);
+    }
+    check_free_size(ptr, sz, h->req, file, line);
+
+    //checking for boundary write error
+    if (!redzone_intact((char*) ptr, h->req)) {
+        std::cerr << "MEMORY BUG: "<<file<<":"<<line<<": detected wild write during free of pointer "<< ptr <<"\n";
+        abort();
+    }
+
+    //Statistics
+    --gstats.nactive;
+    gstats.active_size -= h->req;
+    site_free(h->site, h->req);
+    //mark it free first so the header still says so after coalescing
+    set_header(h, block_size(h), h->size & BLOCK_PREV_FREE);
+    free_block_release(h);
+}
 
+//checks that ptr could have been handed out at all
+static void check_in_heap(void* ptr) {
+    //nothing outside [heap_min, heap_max] was ever handed out
+    if (!in_heap_bounds(ptr)){
+    std::cerr << "MEMORY BUG: invalid free of pointer "<< ptr <<", not in heap\n";
+    abort();
+    }
+}
 
 /// m61_free(ptr, file, line)
 ///    Frees the memory allocation pointed to by `ptr`. If `ptr == nullptr`,
@@ -199,72 +2334,169 @@ void* m61_realloc(void* ptr, size_t sz, const char* file, int line)
 void m61_free(void* ptr, const char* file, int line) {
     // avoid uninitialized variable warnings
     (void) ptr, (void) file, (void) line;
+    if (tracing()) {
+        trace_free(ptr, file, line);
+        trace_pause pause;
+        return m61_free(ptr, file, line);
+    }
     //check if ptr passed as arg is null, if so return empty
     if (ptr == nullptr) {return;}
-    //check if ptr passed as arg is already freed, if so return empty
-    if (freed_addresses.find(ptr) != freed_addresses.end()) {
-    std::cerr << "MEMORY BUG: invalid free of pointer "<< ptr <<", double free\n";
-    abort();
+    check_in_heap(ptr);
+    if (scan_due(tcache)) {
+        std::lock_guard<std::mutex> guard(heap_lock);
+        scan_step();
     }
-    //checking invalid free on non-heap pointer
-    if (ptr < first_heap || (uintptr_t)ptr > ((uintptr_t) first_heap + default_buffer.size)){
-    std::cerr << "MEMORY BUG: invalid free of pointer "<< ptr <<", not in heap\n";
-    abort();
+    if (in_guard_pool(ptr)) {
+        std::lock_guard<std::mutex> guard(heap_lock);
+        guarded_free(ptr, file, line);
+        return;
     }
-    //check if ptr passed as arg is part of active_addresses map, if 
-    auto it = active_addresses.find(ptr);
-    if (it == active_addresses.end()) {
-        auto it2 = active_addresses.lower_bound(ptr); 
-        it2--; //puts it2 iterator to the closest lower value to ptr in the map, if such a value exists
-        std::cerr << "MEMORY BUG: "<<file<<":"<<line<<": invalid free of pointer "<< ptr <<", not allocated\n";
-        if (ptr > it2->first && ptr < (void*)((uintptr_t)it2->first + it2->second.actual_size+it2->second.padding_size)){
-            std::cerr <<file<<":"<<it2->second.line<<": "<< ptr <<" is "<< ((uintptr_t)ptr - (uintptr_t)it2->first) <<" bytes inside a "<<it2->second.actual_size<<" byte region allocated here\n";
-        }
-        abort();
+    //small objects go back to this thread's cache without taking the lock
+    if (slab_page* sp = slab_lookup(ptr)) {
+        tcache_free(sp, ptr, file, line);
+        return;
     }
-
-    //checking for boundary write error
-    char* magicptrcheck = (char*) ((uintptr_t) ptr + it->second.actual_size);
-    if (*magicptrcheck != 61){
-        std::cerr << "MEMORY BUG: "<<file<<":"<<line<<": detected wild write during free of pointer "<< ptr <<"\n";
-        abort();
+    if (!arena_of(ptr)) {
+        big_free(ptr, file, line);
+        return;
     }
 
-    //adding the ptr to freed addresses map after coalescing
-    size_t total_free_size = (it -> second.actual_size) + (it -> second.padding_size);
-    
-    //assertion just to make sure
-    assert (ptr!=nullptr);
+    std::lock_guard<std::mutex> guard(heap_lock);
+    general_free(ptr, file, line);
+}
+
 
-    //Coalesce down
-    auto prev_block = freed_addresses.lower_bound(ptr);
-    if (prev_block != freed_addresses.begin()){  
-        --prev_block;
-        if (prev_block != freed_addresses.begin() && ((uintptr_t) prev_block->first == (uintptr_t) ptr - prev_block->second)) {
-                total_free_size += prev_block->second;
-                ptr = prev_block->first;
-                --prev_block;
-                freed_addresses.erase(ptr);
+/// m61_free_sized(ptr, sz, file, line)
+///    Like m61_free, but `sz` must be the size `ptr` was allocated (or last
+///    reallocated) with. Only sizes up to `slab_max_object` can be slab objects,
+///    so bigger ones skip the slab lookup, and each path checks `sz`
+///    against the size it finds anyway.
+
+void m61_free_sized(void* ptr, size_t sz, const char* file, int line) {
+    if (tracing()) {
+        trace_free(ptr, file, line);
+        trace_pause pause;
+        return m61_free_sized(ptr, sz, file, line);
+    }
+    if (ptr == nullptr) {
+        return;
+    }
+    check_in_heap(ptr);
+    if (scan_due(tcache)) {
+        std::lock_guard<std::mutex> guard(heap_lock);
+        scan_step();
+    }
+    if (in_guard_pool(ptr)) {
+        std::lock_guard<std::mutex> guard(heap_lock);
+        guarded_free(ptr, file, line, sz);
+        return;
+    }
+    m61_memory_buffer* a = arena_of(ptr);
+    if (!a) {
+        big_free(ptr, file, line, sz);
+        return;
+    }
+    if (sz <= slab_max_object) {
+        if (slab_page* sp = slab_in(a, ptr)) {
+            tcache_free(sp, ptr, file, line, sz);
+            return;
         }
     }
+    std::lock_guard<std::mutex> guard(heap_lock);
+    general_free(ptr, file, line, sz);
+}
 
-    //Coalesce up
-    auto next_block = freed_addresses.upper_bound(ptr);
-    while (next_block != freed_addresses.begin() && next_block != freed_addresses.end() && (void*) next_block->first == (void*) ((uintptr_t)ptr + total_free_size)) 
+
+/// m61_malloc_batch(n, sz, out, file, line)
+///    Allocates `n` objects of `sz` bytes each into `out[0..n)`, taking the
+///    lock and looking up the site once instead of `n` times. Returns the
+///    number allocated; if that is less than `n`, the rest of `out` is
+///    `nullptr`.
+
+size_t m61_malloc_batch(size_t n, size_t sz, void** out, const char* file, int line) {
+    if (tracing()) {
+        size_t count;
         {
-            size_t size_added = next_block->second;
-            ++next_block;
-            freed_addresses.erase((void*) ((uintptr_t) ptr + total_free_size));
-            total_free_size += size_added;
+            trace_pause pause;
+            count = m61_malloc_batch(n, sz, out, file, line);
+        }
+        for (size_t i = 0; i != n; ++i) {
+            trace_alloc(M61_TRACE_MALLOC, file, line, sz, out[i]);
+        }
+        return count;
     }
+    thread_cache& tc = tcache;
+    size_t i = 0;
+    if (sz <= slab_max_object) {
+        uint32_t site = tcache_site(tc, file, line);
+        for (; i != n; ++i) {
+            if (!(out[i] = tcache_alloc(tc, sz, site))) {
+                break;
+            }
+        }
+    }
+    if (wants_mapping(sz)) {
+        for (; i != n && (out[i] = big_alloc(sz, file, line)); ++i) {
+        }
+    } else if (i != n) {
+        std::lock_guard<std::mutex> guard(heap_lock);
+        uint32_t site = site_id(file, line);
+        for (; i != n && (out[i] = general_alloc(tc, sz, site)); ++i) {
+        }
+    }
+    size_t count = i;
+    for (; i < n; ++i) {
+        out[i] = nullptr;
+    }
+    return count;
+}
 
-    //Statistics
-    --gstats.nactive;
-    gstats.active_size -= it -> second.actual_size;
-    freed_addresses.insert ({ptr, total_free_size});
-    active_addresses.erase (it);
 
-    
+/// m61_free_batch(n, ptrs, file, line)
+///    Frees `ptrs[0..n)` (null pointers are skipped), taking the lock once
+///    for all of them that need it.
+
+void m61_free_batch(size_t n, void* const* ptrs, const char* file, int line) {
+    if (tracing()) {
+        for (size_t i = 0; i != n; ++i) {
+            trace_free(ptrs[i], file, line);
+        }
+        trace_pause pause;
+        return m61_free_batch(n, ptrs, file, line);
+    }
+    //blocks in arenas first, under one lock: freeing slab objects can give
+    //an emptied slab page back, after which its objects would look like
+    //blocks. nothing here makes new slab pages, so the rest keep their kind
+    {
+        std::unique_lock<std::mutex> guard(heap_lock, std::defer_lock);
+        for (size_t i = 0; i != n; ++i) {
+            if (ptrs[i]) {
+                check_in_heap(ptrs[i]);
+                m61_memory_buffer* a = in_guard_pool(ptrs[i]) ? nullptr : arena_of(ptrs[i]);
+                if (a && !slab_in(a, ptrs[i])) {
+                    if (!guard.owns_lock()) {
+                        guard.lock();
+                    }
+                    general_free(ptrs[i], file, line);
+                }
+            }
+        }
+    }
+    //then slab objects and big blocks, which don't want the lock held
+    for (size_t i = 0; i != n; ++i) {
+        if (!ptrs[i]) {
+            continue;
+        } else if (in_guard_pool(ptrs[i])) {
+            std::lock_guard<std::mutex> guard(heap_lock);
+            guarded_free(ptrs[i], file, line);
+        } else if (m61_memory_buffer* a = arena_of(ptrs[i])) {
+            if (slab_page* sp = slab_in(a, ptrs[i])) {
+                tcache_free(sp, ptrs[i], file, line);
+            }
+        } else {
+            big_free(ptrs[i], file, line);
+        }
+    }
 }
 
 
@@ -276,36 +2508,290 @@ void m61_free(void* ptr, const char* file, int line) {
 ///    also return `nullptr` if `count == 0` or `size == 0`.
 
 void* m61_calloc(size_t count, size_t sz, const char* file, int line) {
-    if (count > SIZE_MAX / sz || (sz*count) >= default_buffer.size) {
+    if (tracing()) {
+        void* ptr;
+        {
+            trace_pause pause;
+            ptr = m61_calloc(count, sz, file, line);
+        }
+        trace_alloc(M61_TRACE_CALLOC, file, line, count * sz, ptr);
+        return ptr;
+    }
+    if (sz != 0 && count > SIZE_MAX / sz) {
+        std::lock_guard<std::mutex> guard(heap_lock);
         ++gstats.nfail;
         gstats.fail_size += sz;
         return nullptr;
     }
-    void* ptr = m61_malloc(count * sz, file, line);
+    sz *= count;
+    //big blocks are fresh mappings, already zero
+    if (wants_mapping(sz)) {
+        return big_alloc(sz, file, line);
+    }
+    if (sz <= slab_max_object) {
+        void* ptr = m61_malloc(sz, file, line);
+        if (ptr) {
+            memset(ptr, 0, sz);
+        }
+        return ptr;
+    }
+    //arena blocks only need clearing where their pages may have been used
+    thread_cache& tc = tcache;
+    page_span clean[2];
+    char* ptr;
+    {
+        std::lock_guard<std::mutex> guard(heap_lock);
+        ptr = (char*) general_alloc(tc, sz, site_id(file, line), clean);
+    }
     if (ptr) {
-        memset(ptr, 0, count * sz);
+        uintptr_t pos = (uintptr_t) ptr;
+        uintptr_t end = pos + sz;
+        for (page_span c : clean) {
+            if (c.lo < c.hi && c.hi > pos && c.lo < end) {
+                if (c.lo > pos) {
+                    memset((void*) pos, 0, c.lo - pos);
+                }
+                pos = std::min(c.hi, end);
+            }
+        }
+        memset((void*) pos, 0, end - pos);
     }
     return ptr;
 }
 
 
+//user arenas (m61_arena) are a list of chunks, each one m61 allocation:
+//[arena_chunk][objects ...]. only the first chunk is bumped through; chunks
+//for objects too big to share one go in behind it
+struct arena_chunk {
+    arena_chunk* next;
+    size_t size;                // bytes after this header
+};
+
+struct m61_arena {
+    arena_chunk* chunks;
+    char* pos;                  // free space left in the first chunk
+    char* end;
+    size_t chunk_size;
+    const char* file;           // chunks are allocated at the creation site
+    int line;
+};
+
+/// m61_arena_create(chunk_size, file, line)
+///    Returns a new, empty arena that allocates `chunk_size` bytes at a
+///    time, or `nullptr` if out of memory.
+
+m61_arena* m61_arena_create(size_t chunk_size, const char* file, int line) {
+    m61_arena* arena = (m61_arena*) m61_malloc(sizeof(m61_arena), file, line);
+    if (arena) {
+        arena->chunks = nullptr;
+        arena->pos = arena->end = nullptr;
+        arena->chunk_size = chunk_size < 256 ? 256 : chunk_size;
+        arena->file = file;
+        arena->line = line;
+    }
+    return arena;
+}
+
+/// m61_arena_alloc(arena, sz)
+///    Returns `sz` bytes from `arena`, or `nullptr` if out of memory.
+
+void* m61_arena_alloc(m61_arena* arena, size_t sz) {
+    size_t alignment = alignof(std::max_align_t);
+    if (sz > SIZE_MAX - alignment - sizeof(arena_chunk)) {
+        return nullptr;
+    }
+    sz = (sz + alignment - 1) & ~(alignment - 1);
+    if (sz <= (size_t) (arena->end - arena->pos)) {
+        void* ptr = arena->pos;
+        arena->pos += sz;
+        return ptr;
+    }
+    //objects bigger than a quarter chunk get a chunk of their own, so the
+    //space left in the current one isn't wasted
+    bool own_chunk = sz > arena->chunk_size / 4;
+    size_t csize = own_chunk ? sz : arena->chunk_size;
+    arena_chunk* c = (arena_chunk*) m61_malloc(sizeof(arena_chunk) + csize, arena->file, arena->line);
+    if (!c) {
+        return nullptr;
+    }
+    c->size = csize;
+    char* data = (char*) (c + 1);
+    if (own_chunk && arena->chunks) {
+        c->next = arena->chunks->next;
+        arena->chunks->next = c;
+        return data;
+    }
+    c->next = arena->chunks;
+    arena->chunks = c;
+    arena->pos = data + sz;
+    arena->end = data + csize;
+    return data;
+}
+
+/// m61_arena_reset(arena)
+///    Frees every object allocated from `arena`, keeping one chunk of the
+///    usual size for what comes next.
+
+void m61_arena_reset(m61_arena* arena) {
+    arena_chunk* keep = nullptr;
+    arena_chunk* c = arena->chunks;
+    while (c) {
+        arena_chunk* next = c->next;
+        if (!keep && c->size == arena->chunk_size) {
+            keep = c;
+        } else {
+            m61_free(c, arena->file, arena->line);
+        }
+        c = next;
+    }
+    arena->chunks = keep;
+    arena->pos = arena->end = nullptr;
+    if (keep) {
+        keep->next = nullptr;
+        arena->pos = (char*) (keep + 1);
+        arena->end = arena->pos + keep->size;
+    }
+}
+
+/// m61_arena_destroy(arena)
+///    Frees every object allocated from `arena`, and `arena`.
+
+void m61_arena_destroy(m61_arena* arena) {
+    arena_chunk* c = arena->chunks;
+    while (c) {
+        arena_chunk* next = c->next;
+        m61_free(c, arena->file, arena->line);
+        c = next;
+    }
+    m61_free(arena, arena->file, arena->line);
+}
+
+
+/// m61_set_fit_policy(policy)
+///    Chooses how m61_malloc picks among free blocks. Best fit is the
+///    default; first fit is the original address-order scan.
+
+void m61_set_fit_policy(m61_fit_policy policy) {
+    std::lock_guard<std::mutex> guard(heap_lock);
+    std::atomic_ref<m61_fit_policy>(fit_policy).store(policy, std::memory_order_relaxed);
+}
+
+
+/// m61_set_sample_rate(n)
+///    Sets how often allocations are sampled into the guarded pool: about
+///    one in `n`, or never if `n` is 0. A persistent heap never samples,
+///    since the guarded pool isn't in its file.
+
+void m61_set_sample_rate(unsigned n) {
+    if (!pheap) {
+        sample_rate.store(n, std::memory_order_relaxed);
+    }
+}
+
+
+/// m61_set_scan_interval(n)
+///    Makes the heap scanner take a step every `n` calls to m61_malloc and
+///    m61_free, or never if `n` is 0.
+
+void m61_set_scan_interval(unsigned n) {
+    scan_interval.store(n, std::memory_order_relaxed);
+}
+
+
+/// m61_check_heap()
+///    Checks every block header and every live object's red zone now,
+///    reporting a memory bug for the first one damaged.
+
+void m61_check_heap() {
+    std::lock_guard<std::mutex> guard(heap_lock);
+    for (int i = 0; i != narenas.load(std::memory_order_relaxed); ++i) {
+        block_header* h = (block_header*) arenas[i]->buffer;
+        while (true) {
+            scan_block(arenas[i], h);
+            if (block_size(h) == 0) {
+                break;
+            }
+            h = block_next(h);
+        }
+    }
+    scan_big_blocks();
+}
+
+
 /// m61_get_statistics()
 ///    Return the current memory statistics.
 
 m61_statistics m61_get_statistics() {
-    return gstats;
+    std::lock_guard<std::mutex> guard(heap_lock);
+    m61_statistics stats = gstats;
+    //arena pages count as resident unless we know they were released (or
+    //never touched); big blocks always do
+    stats.heap_mapped = narenas.load(std::memory_order_relaxed) * arena_size + big_mapped_bytes;
+    stats.heap_resident = stats.heap_mapped - released_bytes;
+    stats.heap_backing = default_buffer.backing;
+    for (int i = 1; i < narenas.load(std::memory_order_relaxed); ++i) {
+        if (arenas[i]->backing != stats.heap_backing) {
+            stats.heap_backing = M61_PAGES_MIXED;
+        }
+    }
+    //plus whatever the thread caches have handed out on their own
+    for (thread_cache* tc = thread_caches; tc; tc = tc->next) {
+        stats.nactive += tc->nactive.load(std::memory_order_relaxed);
+        stats.active_size += tc->active_size.load(std::memory_order_relaxed);
+        stats.ntotal += tc->ntotal.load(std::memory_order_relaxed);
+        stats.total_size += tc->total_size.load(std::memory_order_relaxed);
+    }
+    return stats;
+}
+
+
+/// m61_get_extended_statistics()
+///    Returns the extended memory statistics. Everything is maintained as
+///    the heap changes; the only search is for the largest free block,
+///    which must be in the highest non-empty bin.
+
+m61_extended_statistics m61_get_extended_statistics() {
+    m61_extended_statistics stats = {};
+    stats.peak_active_size = peak_live_bytes.load(std::memory_order_relaxed);
+    for (int i = 0; i != size_buckets; ++i) {
+        stats.size_histogram[i] = live_histogram[i].load(std::memory_order_relaxed);
+    }
+    std::lock_guard<std::mutex> guard(heap_lock);
+    stats.nfree_blocks = nfree_blocks;
+    stats.free_size = free_bytes;
+    stats.largest_free_block = free_largest();
+    if (free_bytes != 0) {
+        stats.fragmentation = 1 - (double) stats.largest_free_block / free_bytes;
+    }
+    return stats;
 }
 
 
-/// m61_print_statistics()
-///    Prints the current memory statistics.
+/// m61_print_statistics(extended)
+///    Prints the current memory statistics, and the extended statistics
+///    too if `extended` is true.
 
-void m61_print_statistics() {
+void m61_print_statistics(bool extended) {
     m61_statistics stats = m61_get_statistics();
     printf("alloc count: active %10llu   total %10llu   fail %10llu\n",
            stats.nactive, stats.ntotal, stats.nfail);
     printf("alloc size:  active %10llu   total %10llu   fail %10llu\n",
            stats.active_size, stats.total_size, stats.fail_size);
+    if (!extended) {
+        return;
+    }
+    m61_extended_statistics x = m61_get_extended_statistics();
+    printf("alloc peak:  active %10llu\n", x.peak_active_size);
+    printf("free blocks: count  %10llu   size  %10llu   largest %10llu   fragmentation %.3f\n",
+           x.nfree_blocks, x.free_size, x.largest_free_block, x.fragmentation);
+    for (int i = 0; i != size_buckets; ++i) {
+        if (x.size_histogram[i] != 0) {
+            unsigned long long lo = i == 0 ? 0 : 1ULL << (i - 1);
+            unsigned long long hi = i == 0 ? 0 : (1ULL << (i - 1)) * 2 - 1;
+            printf("alloc sizes: %10llu - %10llu   active %10llu\n", lo, hi, x.size_histogram[i]);
+        }
+    }
 }
 
 
@@ -314,10 +2800,271 @@ void m61_print_statistics() {
 ///    memory.
 
 void m61_print_leak_report() {
-    auto it = active_addresses.begin(); //iterating through the whole active addresses map and printing
-    while (it != active_addresses.end()) {
-         fprintf(stdout, "LEAK CHECK: %s:%d: allocated object %p with size %zu\n", it->second.file, it->second.line, it->first, it->second.actual_size);
-        ++it;
+    std::lock_guard<std::mutex> guard(heap_lock);
+    //walking every arena block by block and printing the allocated ones
+    for (int i = 0; i != narenas.load(std::memory_order_relaxed); ++i) {
+        block_header* h = (block_header*) arenas[i]->buffer;
+        while (block_size(h) != 0) {
+            if ((h->size & BLOCK_SLAB)) {
+                //every used slot of a slab page is its own allocation, unless
+                //it is only parked in a thread cache
+                slab_page* sp = slab_of_block(h);
+                for (size_t slot = 0; slot != sp->nslots; ++slot) {
+                    if (slab_used(sp, slot) && slab_sites(sp)[slot] != slab_cached) {
+                        const site_entry& site = sites[slab_sites(sp)[slot]];
+                        fprintf(stdout, "LEAK CHECK: %s:%d: allocated object %p with size %zu\n", site.file, site.line, slab_slots(sp) + slot * sp->slot_size, (size_t) slab_sizes(sp)[slot]);
+                    }
+                }
+            } else if ((h->size & BLOCK_ALLOC)) {
+                const site_entry& site = sites[h->site];
+                fprintf(stdout, "LEAK CHECK: %s:%d: allocated object %p with size %zu\n", site.file, site.line, block_payload(h), h->req);
+            }
+            h = block_next(h);
+        }
+    }
+    //and the ones with mappings of their own
+    for (block_header* h : big_blocks) {
+        const site_entry& site = sites[h->site];
+        fprintf(stdout, "LEAK CHECK: %s:%d: allocated object %p with size %zu\n", site.file, site.line, block_payload(h), h->req);
+    }
+    //and sampled ones
+    for (guarded_slot& slot : guard_slot_info) {
+        if (slot.live) {
+            const site_entry& site = sites[slot.site];
+            fprintf(stdout, "LEAK CHECK: %s:%d: allocated object %p with size %zu\n", site.file, site.line, slot.ptr, slot.size);
+        }
+    }
+}
+
+
+/// m61_get_site_statistics()
+///    Returns the heap profile counters of every site that has allocated.
+
+std::vector<m61_site_statistics> m61_get_site_statistics() {
+    std::vector<m61_site_statistics> result;
+    std::lock_guard<std::mutex> guard(heap_lock);
+    for (uint32_t id = 0; id != sites.size(); ++id) {
+        site_counters& sc = site_stats(id);
+        if (sc.total_count.load(std::memory_order_relaxed) == 0) {
+            continue;
+        }
+        result.push_back({
+            .file = sites[id].file,
+            .line = sites[id].line,
+            .live_count = sc.live_count.load(std::memory_order_relaxed),
+            .live_size = sc.live_size.load(std::memory_order_relaxed),
+            .total_count = sc.total_count.load(std::memory_order_relaxed),
+            .total_size = sc.total_size.load(std::memory_order_relaxed),
+            .peak_size = sc.peak_size.load(std::memory_order_relaxed)
+        });
+    }
+    return result;
+}
+
+
+/// m61_print_heap_profile(n)
+///    Prints the `n` sites holding the most live bytes.
+
+void m61_print_heap_profile(size_t n) {
+    std::vector<m61_site_statistics> stats = m61_get_site_statistics();
+    auto heavier = [] (const m61_site_statistics& a, const m61_site_statistics& b) {
+        if (a.live_size != b.live_size) {
+            return a.live_size > b.live_size;
+        }
+        return a.peak_size > b.peak_size;
+    };
+    n = std::min(n, stats.size());
+    std::partial_sort(stats.begin(), stats.begin() + n, stats.end(), heavier);
+    for (size_t i = 0; i != n; ++i) {
+        const m61_site_statistics& st = stats[i];
+        printf("HEAP PROFILE: %s:%d: %llu bytes live in %llu objects, peak %llu, %llu allocations\n",
+               st.file, st.line, st.live_size, st.live_count, st.peak_size, st.total_count);
+    }
+}
+
+
+//opening a persistent heap. anything wrong with the file is fatal: carrying
+//on with an empty heap would quietly lose whatever the program keeps there
+[[noreturn]] static void persistent_fail(const char* path, const char* why) {
+    std::cerr << "m61: can't open persistent heap " << path << ": " << why << "\n";
+    exit(1);
+}
+
+//counts a live object found in a reopened heap as allocated
+static void persistent_count(uint32_t site, void* ptr, size_t sz) {
+    site_alloc(site, sz);
+    ++gstats.nactive;
+    gstats.active_size += sz;
+    ++gstats.ntotal;
+    gstats.total_size += sz;
+    note_heap_range((uintptr_t) ptr, (uintptr_t) ptr + sz);
+}
+
+//rebuilds the bins, slab lists and statistics from the blocks of arena a,
+//which an earlier run left behind, giving their sites this run's ids from
+//`remap`. slots that were parked in thread caches are free again, and site
+//pools start over. heap_lock must be held
+static void persistent_adopt(const char* path, m61_memory_buffer* a,
+                             const std::vector<uint32_t>& remap) {
+    auto renumber = [&] (uint32_t site) {
+        return site < remap.size() ? remap[site] : 0;
+    };
+    block_header* h = (block_header*) a->buffer;
+    while (true) {
+        if (h->check != header_check(h)
+            || (char*) h + block_size(h) > a->buffer + a->size - header_size) {
+            persistent_fail(path, "corrupt block header");
+        }
+        if (block_size(h) == 0) {
+            break;
+        }
+        if (h->size & BLOCK_SLAB) {
+            slab_page* sp = slab_of_block(h);
+            sp->owner = 0;
+            slab_set_frame((char*) h, true);
+            for (size_t slot = 0; slot != sp->nslots; ++slot) {
+                uint32_t& site = slab_sites(sp)[slot];
+                if (!slab_used(sp, slot)) {
+                    continue;
+                } else if (site == slab_cached) {
+                    store_bits(sp->used[slot / 64], sp->used[slot / 64] & ~(uint64_t(1) << (slot % 64)));
+                    --sp->nused;
+                } else {
+                    site = renumber(site);
+                    persistent_count(site, slab_slots(sp) + slot * sp->slot_size, slab_sizes(sp)[slot]);
+                }
+            }
+            if (sp->nused != sp->nslots) {
+                slab_push(sp, sp->slot_size / 16 - 1);
+            }
+        } else if (h->size & BLOCK_ALLOC) {
+            h->site = renumber(h->site);
+            persistent_count(h->site, block_payload(h), h->req);
+        } else {
+            free_insert(h, block_size(h), dirty_pages(h));
+        }
+        h = block_next(h);
+    }
+}
+
+//maps the persistent heap in `path`, making it if the file is empty, and
+//puts its arenas in place of the usual ones. heap_lock must be held
+static void persistent_open(const char* path) {
+    int fd = open(path, O_RDWR | O_CREAT | O_CLOEXEC, 0666);
+    struct stat st;
+    if (fd < 0 || fstat(fd, &st) != 0) {
+        persistent_fail(path, strerror(errno));
+    }
+    //an existing heap goes back where it was made
+    bool fresh = st.st_size == 0;
+    uintptr_t base = persistent_default_base;
+    if (!fresh) {
+        uint64_t start[3];
+        if (pread(fd, start, sizeof(start), 0) != (ssize_t) sizeof(start)
+            || start[0] != persistent_magic || start[2] != arena_size) {
+            persistent_fail(path, "not an m61 heap");
+        }
+        base = start[1];
+    }
+    if (const char* env = getenv("M61_HEAP_BASE")) {
+        uintptr_t want = strtoull(env, nullptr, 0);
+        if (!fresh && want != base) {
+            persistent_fail(path, "made at a different M61_HEAP_BASE");
+        }
+        base = want;
+    }
+    //reserve room for every arena the heap could grow to; the file only
+    //covers the ones in use
+    size_t reserve = persistent_header_size + max_arenas * arena_size;
+    void* p = mmap((void*) base, reserve, PROT_READ | PROT_WRITE,
+                   MAP_SHARED | MAP_FIXED_NOREPLACE, fd, 0);
+    if (p == MAP_FAILED) {
+        persistent_fail(path, strerror(errno));
+    } else if (p != (void*) base) {
+        munmap(p, reserve);
+        persistent_fail(path, "its address is taken");
+    }
+    pheap = (persistent_header*) p;
+    pheap_fd = fd;
+    release_advice = MADV_REMOVE;
+    sample_rate.store(0, std::memory_order_relaxed);
+
+    if (fresh) {
+        if (ftruncate(fd, persistent_header_size + arena_size) != 0) {
+            persistent_fail(path, strerror(errno));
+        }
+        pheap->base = base;
+        pheap->arena_size = arena_size;
+        pheap->narenas = 1;
+        pheap->magic = persistent_magic;
+        default_buffer.buffer = persistent_arena(0);
+        default_buffer.size = arena_size;
+        default_buffer.format();
+        for (uint32_t id = 1; id < sites.size(); ++id) {
+            persistent_note_site(id);
+        }
+        return;
+    }
+
+    size_t n = pheap->narenas;
+    if (n == 0 || n > (size_t) max_arenas
+        || (size_t) st.st_size < persistent_header_size + n * arena_size) {
+        persistent_fail(path, "truncated");
+    }
+    default_buffer.buffer = persistent_arena(0);
+    default_buffer.size = arena_size;
+    arenas[0] = &default_buffer;
+    for (size_t i = 1; i != n; ++i) {
+        arenas[i] = new m61_memory_buffer(persistent_arena(i));
     }
+    narenas.store(n, std::memory_order_release);
+
+    //the last run's site ids become this run's: its names stay in the
+    //file, so they can be the new sites' names too
+    std::vector<persistent_site> old(pheap->sites, pheap->sites + std::min(pheap->nsites, persistent_max_sites));
+    pheap->nsites = 0;
+    for (uint32_t id = 1; id < sites.size(); ++id) {
+        persistent_note_site(id);
+    }
+    std::vector<uint32_t> remap(old.size(), 0);
+    for (uint32_t id = 1; id < old.size(); ++id) {
+        if (old[id].name < pheap->names_size) {
+            remap[id] = site_id(pheap->names + old[id].name, old[id].line);
+        }
+    }
+    for (size_t i = 0; i != n; ++i) {
+        persistent_adopt(path, arenas[i], remap);
+    }
+}
+
+//opens the persistent heap, if there is one, once everything it needs
+//(above) is set up
+struct m61_persistent_heap {
+    m61_persistent_heap() {
+        if (const char* path = persistent_file()) {
+            std::lock_guard<std::mutex> guard(heap_lock);
+            persistent_open(path);
+        }
+    }
+};
+static m61_persistent_heap persistent_heap;
+static void* heap_root;                 // the root when the heap isn't persistent
+
+
+/// m61_set_root(ptr)
+///    Makes `ptr` the heap's root object. A persistent heap keeps it in its
+///    file, so a later run gets it back from m61_get_root.
+
+void m61_set_root(void* ptr) {
+    std::lock_guard<std::mutex> guard(heap_lock);
+    (pheap ? pheap->root : heap_root) = ptr;
 }
 
+
+/// m61_get_root()
+///    Returns the heap's root object, or nullptr if none was set.
+
+void* m61_get_root() {
+    std::lock_guard<std::mutex> guard(heap_lock);
+    return pheap ? pheap->root : heap_root;
+}
@@ -6,6 +6,7 @@
 #include <cstdio>
 #include <new>
 #include <random>
+#include <vector>
 
 
 /// m61_malloc(sz, file, line)
@@ -22,12 +23,105 @@ void m61_free(void* ptr, const char* file = __builtin_FILE(), int line = __built
 ///    is initialized to zero.
 void* m61_calloc(size_t count, size_t sz, const char* file = __builtin_FILE(), int line = __builtin_LINE());
 
+/// m61_free_sized(ptr, sz, file, line)
+///    Free `ptr`, which was allocated with size `sz`. Faster than m61_free.
+void m61_free_sized(void* ptr, size_t sz, const char* file = __builtin_FILE(), int line = __builtin_LINE());
+
+/// m61_malloc_batch(n, sz, out, file, line)
+///    Allocate `n` objects of `sz` bytes into `out[0..n)`. Return the
+///    number allocated; the rest of `out` is set to `nullptr`.
+size_t m61_malloc_batch(size_t n, size_t sz, void** out, const char* file = __builtin_FILE(), int line = __builtin_LINE());
+
+/// m61_free_batch(n, ptrs, file, line)
+///    Free `ptrs[0..n)`.
+void m61_free_batch(size_t n, void* const* ptrs, const char* file = __builtin_FILE(), int line = __builtin_LINE());
+
+/// m61_aligned_alloc(align, sz, file, line)
+///    Return a pointer to `sz` bytes of newly-allocated dynamic memory
+///    aligned to `align` bytes, a power of two, or `nullptr` if `align`
+///    is not one. Free it with m61_free like any other allocation.
+void* m61_aligned_alloc(size_t align, size_t sz, const char* file = __builtin_FILE(), int line = __builtin_LINE());
+
+/// m61_posix_memalign(ptr, align, sz, file, line)
+///    Like m61_aligned_alloc, storing the allocation in `*ptr`. Return 0,
+///    EINVAL if `align` is not a power of two multiple of sizeof(void*),
+///    or ENOMEM if out of memory.
+int m61_posix_memalign(void** ptr, size_t align, size_t sz, const char* file = __builtin_FILE(), int line = __builtin_LINE());
+
 // m61_realloc (ptr, file, line)
 //does the job as described in the pset description (hopefully) and that description is copied into the 
 //main .cc file if you are interested in looking at that. 
 void* m61_realloc(void* ptr, size_t sz, const char* file = __builtin_FILE(), int line = __builtin_LINE());
 
 
+/// m61_set_sample_rate(n)
+///    Place about one in `n` allocations of up to a page (none if `n` is 0)
+///    in a guarded pool, where overflows and uses after free fault at once
+///    and are reported as memory bugs. The default is the M61_SAMPLE_RATE
+///    environment variable, or 0.
+void m61_set_sample_rate(unsigned n);
+
+/// m61_set_scan_interval(n)
+///    Check a few heap blocks every `n` calls to m61_malloc and m61_free
+///    (never if `n` is 0): their headers, and the red zone after each live
+///    object (at least 16 bytes, running to a 16-byte boundary). Damage is
+///    reported as a memory bug naming where the object was allocated. The
+///    default is the M61_SCAN_INTERVAL environment variable, or 0.
+void m61_set_scan_interval(unsigned n);
+
+/// m61_check_heap()
+///    Check every block header and live object's red zone now.
+void m61_check_heap();
+
+
+/// m61_fit_policy
+///    How m61_malloc chooses a free block. M61_FIRST_FIT takes the
+///    lowest-addressed block that fits (a walk over every block);
+///    M61_BEST_FIT takes a block from the smallest size bin that fits.
+///    M61_SITE_FIT is best fit, except that each site (file:line) that
+///    allocates a lot gets memory of its own, so its objects are adjacent.
+enum m61_fit_policy {
+    M61_FIRST_FIT,
+    M61_BEST_FIT,
+    M61_SITE_FIT
+};
+
+/// m61_set_fit_policy(policy)
+///    Set the placement policy for later allocations. Default M61_BEST_FIT.
+void m61_set_fit_policy(m61_fit_policy policy);
+
+
+/// Persistent heaps
+///    With M61_HEAP_FILE=FILE in the environment, the whole heap lives in
+///    FILE, mapped shared at a fixed address (the one FILE was made at,
+///    M61_HEAP_BASE, or 0x7e8000000000), so pointers stored in it stay
+///    good. A later run with the same FILE finds every object that was
+///    still allocated, and can free them, report them as leaks, and so on.
+///    Allocations too big for one arena (8 MiB) fail, and none are sampled.
+///    The mapping is shared, so a child process made by fork() must not
+///    use the heap.
+
+/// m61_set_root(ptr)
+///    Make `ptr` the heap's root object, which m61_get_root returns from
+///    now on, including in later runs that open the same persistent heap.
+void m61_set_root(void* ptr);
+
+/// m61_get_root()
+///    Return the heap's root object, or `nullptr` if none was set.
+void* m61_get_root();
+
+
+/// m61_page_backing
+///    What kind of pages back the heap's arenas. Huge pages are used only
+///    when asked for (M61_HUGEPAGES=1 in the environment, or building with
+///    HUGEPAGES=1), and only if the system provides them.
+enum m61_page_backing {
+    M61_PAGES_NORMAL,                   // ordinary 4 KiB pages
+    M61_PAGES_TRANSPARENT_HUGE,         // 2 MiB-aligned, madvise(MADV_HUGEPAGE)
+    M61_PAGES_HUGETLB,                  // mmap(MAP_HUGETLB)
+    M61_PAGES_MIXED                     // arenas got different kinds
+};
+
 /// m61_statistics
 ///    Structure tracking memory statistics.
 struct m61_statistics {
@@ -39,15 +133,36 @@ struct m61_statistics {
     unsigned long long fail_size;       // # bytes in failed alloc attempts
     uintptr_t heap_min;                 // smallest allocated addr
     uintptr_t heap_max;                 // largest allocated addr
+    unsigned long long realloc_copied;  // # bytes m61_realloc had to copy
+    unsigned long long heap_mapped;     // # bytes mapped for the heap
+    unsigned long long heap_resident;   // # of those not known to be released
+    m61_page_backing heap_backing;      // pages backing the arenas
 };
 
 /// m61_get_statistics()
 ///    Return the current memory statistics.
 m61_statistics m61_get_statistics();
 
-/// m61_print_statistics()
-///    Print the current memory statistics.
-void m61_print_statistics();
+/// m61_extended_statistics
+///    More memory statistics, for capacity planning.
+struct m61_extended_statistics {
+    unsigned long long peak_active_size;    // most bytes ever in active allocations
+    unsigned long long nfree_blocks;        // # free blocks in the heap
+    unsigned long long free_size;           // # bytes in free blocks
+    unsigned long long largest_free_block;  // # bytes in the largest free block
+    double fragmentation;                   // 1 - largest_free_block / free_size
+    unsigned long long size_histogram[64];  // # active allocations by size: [0] of
+                                            // size 0, [i] of size in [2^(i-1), 2^i)
+};
+
+/// m61_get_extended_statistics()
+///    Return the current extended memory statistics.
+m61_extended_statistics m61_get_extended_statistics();
+
+/// m61_print_statistics(extended)
+///    Print the current memory statistics, and the extended statistics
+///    too if `extended` is true.
+void m61_print_statistics(bool extended = false);
  
 /// m61_print_leak_report()
 ///    Print a report of all currently-active allocated blocks of dynamic
@@ -55,6 +170,53 @@ void m61_print_statistics();
 void m61_print_leak_report();
 
 
+/// m61_site_statistics
+///    Heap profile counters for one allocation site (file:line).
+struct m61_site_statistics {
+    const char* file;
+    int line;
+    unsigned long long live_count;      // # active allocations from this site
+    unsigned long long live_size;       // # bytes in them
+    unsigned long long total_count;     // # total allocations from this site
+    unsigned long long total_size;      // # bytes in them
+    unsigned long long peak_size;       // most bytes ever active at once
+};
+
+/// m61_get_site_statistics()
+///    Return the counters of every site that has ever allocated, in no
+///    particular order.
+std::vector<m61_site_statistics> m61_get_site_statistics();
+
+/// m61_print_heap_profile(n)
+///    Print the `n` sites with the most live bytes (ties broken by peak).
+void m61_print_heap_profile(size_t n = 10);
+
+
+/// m61_trace_event
+///    One record of an allocation trace. Running a program with
+///    M61_TRACE=FILE in the environment writes every allocation and free
+///    to FILE as an array of these; m61replay runs them again.
+enum m61_trace_op : uint8_t {
+    M61_TRACE_MALLOC = 1,               // also m61_malloc_batch, once per object
+    M61_TRACE_CALLOC,
+    M61_TRACE_REALLOC,
+    M61_TRACE_ALIGNED_ALLOC,            // also m61_posix_memalign
+    M61_TRACE_FREE,                     // also m61_free_sized and m61_free_batch
+    M61_TRACE_SITE                      // defines a site; the file name follows
+};
+struct m61_trace_event {
+    uint8_t op;                         // m61_trace_op
+    uint8_t reserved[3];
+    uint32_t site;                      // allocation site (M61_TRACE_SITE: the one defined)
+    uint64_t size;                      // bytes requested (M61_TRACE_SITE: line number)
+    uint64_t id;                        // object allocated or freed, 0 if none
+    uint64_t arg;                       // M61_TRACE_REALLOC: object resized
+                                        // M61_TRACE_ALIGNED_ALLOC: alignment
+                                        // M61_TRACE_SITE: bytes in the file name, which
+                                        // fill the next events (padded with zeroes)
+};
+
+
 /// This magic class lets standard C++ containers use your allocator
 /// instead of the system allocator.
 template <typename T>
@@ -68,8 +230,8 @@ public:
     T* allocate(size_t n) {
         return reinterpret_cast<T*>(m61_malloc(n * sizeof(T), "?", 0));
     }
-    void deallocate(T* ptr, size_t) {
-        m61_free(ptr, "?", 0);
+    void deallocate(T* ptr, size_t n) {
+        m61_free_sized(ptr, n * sizeof(T), "?", 0);
     }
 };
 template <typename T, typename U>
@@ -77,6 +239,92 @@ inline constexpr bool operator==(const m61_allocator<T>&, const m61_allocator<U>
     return true;
 }
 
+
+/// Like m61_allocator, but every allocation is aligned to `Align` bytes
+/// (e.g. a cache line, so elements don't share one with other objects).
+template <typename T, size_t Align = alignof(T)>
+class m61_aligned_allocator {
+    static_assert(Align != 0 && (Align & (Align - 1)) == 0 && Align >= alignof(T),
+                  "Align must be a power of two at least alignof(T)");
+public:
+    using value_type = T;
+    template <typename U> struct rebind {
+        using other = m61_aligned_allocator<U, Align>;
+    };
+    m61_aligned_allocator() noexcept = default;
+    m61_aligned_allocator(const m61_aligned_allocator<T, Align>&) noexcept = default;
+    template <typename U> m61_aligned_allocator(const m61_aligned_allocator<U, Align>&) noexcept {}
+
+    T* allocate(size_t n) {
+        T* ptr = reinterpret_cast<T*>(m61_aligned_alloc(Align, n * sizeof(T), "?", 0));
+        if (!ptr) {
+            throw std::bad_alloc();
+        }
+        return ptr;
+    }
+    void deallocate(T* ptr, size_t n) {
+        m61_free_sized(ptr, n * sizeof(T), "?", 0);
+    }
+};
+template <typename T, typename U, size_t Align>
+inline constexpr bool operator==(const m61_aligned_allocator<T, Align>&, const m61_aligned_allocator<U, Align>&) {
+    return true;
+}
+
+
+/// m61_arena
+///    A region that hands out objects by bumping a pointer through chunks of
+///    m61 memory and frees them all at once. The chunks are ordinary m61
+///    allocations made at the m61_arena_create site, so statistics and the
+///    leak report count them.
+struct m61_arena;
+
+/// m61_arena_create(chunk_size, file, line)
+///    Return a new, empty arena that allocates `chunk_size` bytes at a time.
+m61_arena* m61_arena_create(size_t chunk_size = 64 << 10, const char* file = __builtin_FILE(), int line = __builtin_LINE());
+
+/// m61_arena_alloc(arena, sz)
+///    Return `sz` bytes of uninitialized memory from `arena`, aligned like
+///    m61_malloc's, or `nullptr` if out of memory. There is no way to free
+///    one object; they all go at the next reset or destroy.
+void* m61_arena_alloc(m61_arena* arena, size_t sz);
+
+/// m61_arena_reset(arena)
+///    Free every object allocated from `arena`. The arena keeps one chunk
+///    to allocate from next.
+void m61_arena_reset(m61_arena* arena);
+
+/// m61_arena_destroy(arena)
+///    Free every object allocated from `arena`, and the arena itself.
+void m61_arena_destroy(m61_arena* arena);
+
+
+/// Like m61_allocator, but allocates from an arena. Deallocation does
+/// nothing: memory comes back when the arena is reset or destroyed.
+template <typename T>
+class m61_arena_allocator {
+public:
+    using value_type = T;
+    m61_arena* arena;
+    m61_arena_allocator(m61_arena* a) noexcept : arena(a) {}
+    m61_arena_allocator(const m61_arena_allocator<T>&) noexcept = default;
+    template <typename U> m61_arena_allocator(const m61_arena_allocator<U>& x) noexcept : arena(x.arena) {}
+
+    T* allocate(size_t n) {
+        T* ptr = reinterpret_cast<T*>(m61_arena_alloc(arena, n * sizeof(T)));
+        if (!ptr) {
+            throw std::bad_alloc();
+        }
+        return ptr;
+    }
+    void deallocate(T*, size_t) {
+    }
+};
+template <typename T, typename U>
+inline bool operator==(const m61_arena_allocator<T>& a, const m61_arena_allocator<U>& b) {
+    return a.arena == b.arena;
+}
+
 /// Returns a random integer between `min` and `max`, using randomness from
 /// `randomness`.
 template <typename Engine, typename T>
@@ -0,0 +1,330 @@
+#include "m61.hh"
+#include <cstdio>
+#include <cstring>
+#include <cassert>
+#include <cmath>
+#include <chrono>
+#include <random>
+#include <string>
+#include <vector>
+#include <malloc.h>
+#include <unistd.h>
+#include <sys/resource.h>
+#include <sys/wait.h>
+
+// m61bench [-n OPS] [-a ALLOCATOR] [-p PATTERN]
+//    Runs standard allocation patterns against m61 and against the system
+//    allocator, each pattern and allocator in a fresh copy of this program,
+//    and prints one JSON object per run, in the style of io61_profiler:
+//    throughput, peak RSS (`maxrss`, in KB), the most bytes ever live, and,
+//    at the end of the run, metadata overhead (how much of the allocator's
+//    heap isn't live objects) and how far current RSS grew (`rss_growth`).
+//    `-a` and `-p` restrict the runs to one allocator or pattern.
+
+// heap_size() is what each allocator thinks it holds on to: m61's resident
+// heap pages, or glibc's heap plus mmapped chunks (as in m61replay).
+
+struct m61_heap {
+    static constexpr const char* name = "m61";
+    void* malloc(size_t sz) {
+        return m61_malloc(sz);
+    }
+    void* calloc(size_t n, size_t sz) {
+        return m61_calloc(n, sz);
+    }
+    void* realloc(void* ptr, size_t sz) {
+        return m61_realloc(ptr, sz);
+    }
+    void free(void* ptr) {
+        m61_free(ptr);
+    }
+    size_t heap_size() {
+        return m61_get_statistics().heap_resident;
+    }
+};
+
+struct system_heap {
+    static constexpr const char* name = "system";
+    void* malloc(size_t sz) {
+        return ::malloc(sz);
+    }
+    void* calloc(size_t n, size_t sz) {
+        return ::calloc(n, sz);
+    }
+    void* realloc(void* ptr, size_t sz) {
+        return ::realloc(ptr, sz);
+    }
+    void free(void* ptr) {
+        ::free(ptr);
+    }
+    size_t heap_size() {
+        struct mallinfo2 mi = mallinfo2();
+        return mi.arena + mi.hblkhd;
+    }
+};
+
+
+// Each pattern keeps its objects in `slots`, which are allocated (and
+// touched) before the RSS baseline is taken, and counts one op per call
+// into the heap.
+
+struct bench_state {
+    std::vector<void*> slots;
+    std::vector<size_t> sizes;
+    std::mt19937_64 randomness{61};
+    size_t live = 0;
+    size_t peak_live = 0;
+    size_t ops = 0;
+
+    explicit bench_state(size_t nslots)
+        : slots(nslots, nullptr), sizes(nslots, 0) {
+    }
+    void hold(size_t i, void* ptr, size_t sz) {
+        assert(ptr);
+        // touch it, as a real program would
+        ((char*) ptr)[0] = 61;
+        ((char*) ptr)[sz - 1] = 61;
+        slots[i] = ptr;
+        live += sz - sizes[i];
+        sizes[i] = sz;
+        peak_live = std::max(peak_live, live);
+    }
+    void drop(size_t i) {
+        live -= sizes[i];
+        slots[i] = nullptr;
+        sizes[i] = 0;
+    }
+};
+
+// Frees or allocates a random slot each op, so about half the slots are
+// live at a time.
+template <typename Heap, typename F>
+static void random_slots(Heap& heap, bench_state& s, size_t nops, F size_fn) {
+    std::uniform_int_distribution<size_t> slot(0, s.slots.size() - 1);
+    for (; s.ops < nops; ++s.ops) {
+        size_t i = slot(s.randomness);
+        if (s.slots[i]) {
+            heap.free(s.slots[i]);
+            s.drop(i);
+        } else {
+            size_t sz = size_fn(s.randomness);
+            s.hold(i, heap.malloc(sz), sz);
+        }
+    }
+}
+
+// fixed: 32-byte objects, 10000 slots
+template <typename Heap>
+static void fixed(Heap& heap, bench_state& s, size_t nops) {
+    random_slots(heap, s, nops, [] (std::mt19937_64&) {
+        return size_t(32);
+    });
+}
+
+// powerlaw: Pareto-distributed sizes (alpha 1.2) from 8 bytes to 256KiB
+template <typename Heap>
+static void powerlaw(Heap& heap, bench_state& s, size_t nops) {
+    std::uniform_real_distribution<double> u(0, 1);
+    random_slots(heap, s, nops, [&] (std::mt19937_64& r) {
+        double sz = 8 / pow(1 - u(r), 1 / 1.2);
+        return size_t(std::min(sz, 262144.0));
+    });
+}
+
+// fifo: 20-byte objects freed in allocation order, at most 100 live,
+// like test29
+template <typename Heap>
+static void fifo(Heap& heap, bench_state& s, size_t nops) {
+    size_t n = s.slots.size(), head = 0, tail = 0;
+    std::uniform_int_distribution<int> coin(0, 2);
+    for (; s.ops < nops; ++s.ops) {
+        if (tail - head == n
+            || (tail != head && coin(s.randomness) == 0)) {
+            heap.free(s.slots[head % n]);
+            s.drop(head % n);
+            ++head;
+        } else {
+            s.hold(tail % n, heap.malloc(20), 20);
+            ++tail;
+        }
+    }
+}
+
+// realloc: buffers that start at 16 bytes and grow by a quarter at a time
+// until they pass 64KiB, then are freed
+template <typename Heap>
+static void realloc_growth(Heap& heap, bench_state& s, size_t nops) {
+    std::uniform_int_distribution<size_t> slot(0, s.slots.size() - 1);
+    for (; s.ops < nops; ++s.ops) {
+        size_t i = slot(s.randomness);
+        if (!s.slots[i]) {
+            s.hold(i, heap.malloc(16), 16);
+        } else if (s.sizes[i] > 65536) {
+            heap.free(s.slots[i]);
+            s.drop(i);
+        } else {
+            size_t sz = s.sizes[i] + s.sizes[i] / 4 + 16;
+            s.hold(i, heap.realloc(s.slots[i], sz), sz);
+        }
+    }
+}
+
+// calloc: zeroed arrays of 1 to 2048 8-byte elements
+template <typename Heap>
+static void calloc_arrays(Heap& heap, bench_state& s, size_t nops) {
+    std::uniform_int_distribution<size_t> slot(0, s.slots.size() - 1);
+    std::uniform_int_distribution<size_t> count(1, 2048);
+    for (; s.ops < nops; ++s.ops) {
+        size_t i = slot(s.randomness);
+        if (s.slots[i]) {
+            heap.free(s.slots[i]);
+            s.drop(i);
+        } else {
+            size_t n = count(s.randomness);
+            char* ptr = (char*) heap.calloc(n, 8);
+            assert(ptr && ptr[0] == 0 && ptr[n * 8 - 1] == 0);
+            s.hold(i, ptr, n * 8);
+        }
+    }
+}
+
+struct bench_pattern {
+    const char* name;
+    size_t nslots;
+    void (*m61)(m61_heap&, bench_state&, size_t);
+    void (*system)(system_heap&, bench_state&, size_t);
+};
+
+static const bench_pattern patterns[] = {
+    {"fixed", 10000, fixed<m61_heap>, fixed<system_heap>},
+    {"powerlaw", 10000, powerlaw<m61_heap>, powerlaw<system_heap>},
+    {"fifo", 100, fifo<m61_heap>, fifo<system_heap>},
+    {"realloc", 1000, realloc_growth<m61_heap>, realloc_growth<system_heap>},
+    {"calloc", 1000, calloc_arrays<m61_heap>, calloc_arrays<system_heap>}
+};
+
+
+static double seconds(const timeval& tv) {
+    return tv.tv_sec + tv.tv_usec * 1e-6;
+}
+
+// current resident set size in bytes (ru_maxrss only ever goes up)
+static long current_rss() {
+    long pages = 0, resident = 0;
+    if (FILE* f = fopen("/proc/self/statm", "r")) {
+        if (fscanf(f, "%ld %ld", &pages, &resident) != 2) {
+            resident = 0;
+        }
+        fclose(f);
+    }
+    return resident * sysconf(_SC_PAGESIZE);
+}
+
+template <typename Heap>
+static void run(const bench_pattern& p, void (*fn)(Heap&, bench_state&, size_t),
+                size_t nops) {
+    Heap heap;
+    bench_state s(p.nslots);
+    struct rusage ubefore, uafter;
+    size_t heap_before = heap.heap_size();
+    long rss_before = current_rss();
+    int r = getrusage(RUSAGE_SELF, &ubefore);
+    assert(r >= 0);
+
+    auto start = std::chrono::steady_clock::now();
+    fn(heap, s, nops);
+    std::chrono::duration<double> elapsed = std::chrono::steady_clock::now() - start;
+
+    r = getrusage(RUSAGE_SELF, &uafter);
+    assert(r >= 0);
+    // metadata overhead: the heap's growth beyond the bytes still live
+    size_t heap_after = heap.heap_size();
+    long metadata = std::max(0L, (long) (heap_after - std::min(heap_after, heap_before))
+                                 - (long) s.live);
+    long rss_growth = current_rss() - rss_before;
+    for (size_t i = 0; i != s.slots.size(); ++i) {
+        if (s.slots[i]) {
+            heap.free(s.slots[i]);
+        }
+    }
+
+    double t = elapsed.count();
+    printf("{\"allocator\":\"%s\", \"pattern\":\"%s\", \"ops\":%zu, \"time\":%.6f, "
+           "\"ops_per_sec\":%.0f, \"utime\":%.6f, \"stime\":%.6f, "
+           "\"maxrss\":%ld, \"peak_live\":%zu, \"metadata\":%ld, \"rss_growth\":%ld}\n",
+           Heap::name, p.name, s.ops, t, t > 0 ? s.ops / t : 0,
+           seconds(uafter.ru_utime) - seconds(ubefore.ru_utime),
+           seconds(uafter.ru_stime) - seconds(ubefore.ru_stime),
+           uafter.ru_maxrss, s.peak_live, metadata, rss_growth);
+}
+
+static void usage() {
+    fprintf(stderr, "Usage: m61bench [-n OPS] [-a m61|system] [-p PATTERN]\n");
+    exit(1);
+}
+
+int main(int argc, char** argv) {
+    size_t nops = 2000000;
+    const char* allocator = nullptr;
+    const char* pattern = nullptr;
+    bool child = false;
+    int opt;
+    while ((opt = getopt(argc, argv, "n:a:p:x")) != -1) {
+        if (opt == 'n' && atol(optarg) > 0) {
+            nops = atol(optarg);
+        } else if (opt == 'a') {
+            allocator = optarg;
+        } else if (opt == 'p') {
+            pattern = optarg;
+        } else if (opt == 'x') {
+            child = true;
+        } else {
+            usage();
+        }
+    }
+    if (optind != argc
+        || (allocator && strcmp(allocator, "m61") != 0
+            && strcmp(allocator, "system") != 0)) {
+        usage();
+    }
+
+    bool found = false;
+    for (const bench_pattern& p : patterns) {
+        if (pattern && strcmp(pattern, p.name) != 0) {
+            continue;
+        }
+        found = true;
+        for (const char* a : {"m61", "system"}) {
+            if (allocator && strcmp(allocator, a) != 0) {
+                continue;
+            }
+            if (child) {
+                if (strcmp(a, "m61") == 0) {
+                    run(p, p.m61, nops);
+                } else {
+                    run(p, p.system, nops);
+                }
+                continue;
+            }
+            // a fresh process per run, so peak RSS covers only that run
+            fflush(stdout);
+            std::string n = std::to_string(nops);
+            pid_t pid = fork();
+            assert(pid >= 0);
+            if (pid == 0) {
+                execl("/proc/self/exe", argv[0], "-x", "-n", n.c_str(),
+                      "-a", a, "-p", p.name, nullptr);
+                _exit(1);
+            }
+            int status;
+            waitpid(pid, &status, 0);
+            if (!WIFEXITED(status) || WEXITSTATUS(status) != 0) {
+                fprintf(stderr, "m61bench: %s %s failed\n", a, p.name);
+                exit(1);
+            }
+        }
+    }
+    if (!found) {
+        usage();
+    }
+}
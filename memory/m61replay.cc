@@ -0,0 +1,251 @@
+#include "m61.hh"
+#include <cstdio>
+#include <cstring>
+#include <chrono>
+#include <string>
+#include <vector>
+#include <malloc.h>
+#include <unistd.h>
+
+// m61replay [-n PASSES] TRACE
+//    Runs an allocation trace recorded with M61_TRACE=TRACE against m61
+//    and against the system allocator, and reports each one's throughput,
+//    peak heap size (how far the heap grew during the replay), and
+//    fragmentation (the fraction of that peak beyond the most bytes ever
+//    live). Events run in trace order on one thread, whatever threads made
+//    them.
+
+struct trace_site {
+    std::string file;
+    int line;
+};
+
+struct trace {
+    std::vector<m61_trace_event> events;    // without site definitions
+    std::vector<trace_site> sites;          // indexed by site id
+    uint64_t max_id = 0;
+};
+
+static bool read_trace(const char* filename, trace& t) {
+    FILE* f = fopen(filename, "rb");
+    if (!f) {
+        perror(filename);
+        return false;
+    }
+    m61_trace_event e;
+    t.sites.push_back({"?", 0});
+    while (fread(&e, sizeof(e), 1, f) == 1) {
+        if (e.op == M61_TRACE_SITE) {
+            std::string name(e.arg, '\0');
+            size_t nevents = (e.arg + sizeof(e) - 1) / sizeof(e);
+            for (size_t i = 0; i != nevents; ++i) {
+                m61_trace_event chunk;
+                if (fread(&chunk, sizeof(chunk), 1, f) != 1) {
+                    break;
+                }
+                size_t off = i * sizeof(chunk);
+                memcpy(&name[off], &chunk, std::min(sizeof(chunk), name.size() - off));
+            }
+            if (t.sites.size() <= e.site) {
+                t.sites.resize(e.site + 1, {"?", 0});
+            }
+            t.sites[e.site] = {name, (int) e.size};
+            continue;
+        }
+        if (e.site >= t.sites.size()) {
+            e.site = 0;
+        }
+        t.max_id = std::max(t.max_id, e.id);
+        t.events.push_back(e);
+    }
+    fclose(f);
+    return true;
+}
+
+
+// The two allocators under test. heap_size() is what each thinks it holds
+// on to: m61's resident heap pages, or glibc's heap plus mmapped chunks.
+
+struct m61_heap {
+    const trace& t;
+    static constexpr const char* name = "m61";
+    void* malloc(size_t sz, uint32_t site) {
+        return m61_malloc(sz, t.sites[site].file.c_str(), t.sites[site].line);
+    }
+    void* calloc(size_t sz, uint32_t site) {
+        return m61_calloc(1, sz, t.sites[site].file.c_str(), t.sites[site].line);
+    }
+    void* aligned_alloc(size_t align, size_t sz, uint32_t site) {
+        return m61_aligned_alloc(align, sz, t.sites[site].file.c_str(), t.sites[site].line);
+    }
+    void* realloc(void* ptr, size_t sz, uint32_t site) {
+        return m61_realloc(ptr, sz, t.sites[site].file.c_str(), t.sites[site].line);
+    }
+    void free(void* ptr, uint32_t site) {
+        m61_free(ptr, t.sites[site].file.c_str(), t.sites[site].line);
+    }
+    size_t heap_size() {
+        return m61_get_statistics().heap_resident;
+    }
+};
+
+struct system_heap {
+    const trace& t;
+    static constexpr const char* name = "system";
+    void* malloc(size_t sz, uint32_t) {
+        return ::malloc(sz);
+    }
+    void* calloc(size_t sz, uint32_t) {
+        return ::calloc(1, sz);
+    }
+    void* aligned_alloc(size_t align, size_t sz, uint32_t) {
+        void* ptr;
+        return posix_memalign(&ptr, std::max(align, sizeof(void*)), sz) == 0 ? ptr : nullptr;
+    }
+    void* realloc(void* ptr, size_t sz, uint32_t) {
+        return ::realloc(ptr, sz);
+    }
+    void free(void* ptr, uint32_t) {
+        ::free(ptr);
+    }
+    size_t heap_size() {
+        struct mallinfo2 mi = mallinfo2();
+        return mi.arena + mi.hblkhd;
+    }
+};
+
+
+struct replay_result {
+    double seconds = 0;
+    size_t peak_heap = 0;
+    size_t peak_live = 0;
+};
+
+// Runs every event once, keeping objects in `objs` and `sizes` (indexed by
+// id, all empty). If `measure` is set, samples the heap size every
+// `sample_interval` events and whenever live bytes reach a new high (which
+// costs time, so timed passes don't).
+constexpr size_t sample_interval = 64;
+
+template <typename Heap>
+static void replay(Heap& heap, const trace& t, std::vector<void*>& objs,
+                   std::vector<size_t>& sizes, bool measure, replay_result& r) {
+    // (the driver's own memory may come from the heap under test)
+    size_t baseline = measure ? heap.heap_size() : 0;
+    size_t live = 0;
+    for (size_t i = 0; i != t.events.size(); ++i) {
+        const m61_trace_event& e = t.events[i];
+        void* ptr = nullptr;
+        switch (e.op) {
+        case M61_TRACE_MALLOC:
+            ptr = e.id ? heap.malloc(e.size, e.site) : nullptr;
+            break;
+        case M61_TRACE_CALLOC:
+            ptr = e.id ? heap.calloc(e.size, e.site) : nullptr;
+            break;
+        case M61_TRACE_ALIGNED_ALLOC:
+            ptr = e.id ? heap.aligned_alloc(e.arg, e.size, e.site) : nullptr;
+            break;
+        case M61_TRACE_REALLOC:
+            if (e.id == 0 && e.size == 0 && objs[e.arg]) {
+                // realloc to size 0 freed the object
+                heap.free(objs[e.arg], e.site);
+            } else if (e.id != 0) {
+                ptr = heap.realloc(e.arg ? objs[e.arg] : nullptr, e.size, e.site);
+                if (!ptr) {
+                    // failed on replay; the old object lives on
+                    continue;
+                }
+            } else {
+                // failed when traced; the old object lives on
+                continue;
+            }
+            live -= sizes[e.arg];
+            objs[e.arg] = nullptr;
+            sizes[e.arg] = 0;
+            break;
+        case M61_TRACE_FREE:
+            heap.free(objs[e.id], e.site);
+            live -= sizes[e.id];
+            objs[e.id] = nullptr;
+            sizes[e.id] = 0;
+            break;
+        }
+        if (ptr) {
+            // touch it, as the traced program presumably did
+            if (e.size != 0) {
+                ((char*) ptr)[0] = 61;
+                ((char*) ptr)[e.size - 1] = 61;
+            }
+            objs[e.id] = ptr;
+            sizes[e.id] = e.size;
+            live += e.size;
+        }
+        if (measure) {
+            if (live > r.peak_live || i % sample_interval == 0
+                || i == t.events.size() - 1) {
+                r.peak_live = std::max(r.peak_live, live);
+                size_t h = heap.heap_size();
+                r.peak_heap = std::max(r.peak_heap, h - std::min(h, baseline));
+            }
+        }
+    }
+    // whatever the traced program leaked
+    for (uint64_t id = 0; id != objs.size(); ++id) {
+        if (objs[id]) {
+            heap.free(objs[id], 0);
+            objs[id] = nullptr;
+            sizes[id] = 0;
+        }
+    }
+}
+
+template <typename Heap>
+static replay_result run(const trace& t, int passes) {
+    Heap heap{t};
+    replay_result r;
+    std::vector<void*> objs(t.max_id + 1, nullptr);
+    std::vector<size_t> sizes(t.max_id + 1, 0);
+    replay(heap, t, objs, sizes, true, r);
+    auto start = std::chrono::steady_clock::now();
+    for (int i = 0; i != passes; ++i) {
+        replay(heap, t, objs, sizes, false, r);
+    }
+    std::chrono::duration<double> elapsed = std::chrono::steady_clock::now() - start;
+    r.seconds = elapsed.count() / passes;
+
+    double mops = r.seconds > 0 ? t.events.size() / r.seconds / 1e6 : 0;
+    double frag = r.peak_heap > 0 ? std::max(0.0, 1 - (double) r.peak_live / r.peak_heap) : 0;
+    printf("%-7s %9.4f s  %8.2f Mops/s   peak heap %12zu   peak live %12zu   fragmentation %.3f\n",
+           Heap::name, r.seconds, mops, r.peak_heap, r.peak_live, frag);
+    return r;
+}
+
+static void usage() {
+    fprintf(stderr, "Usage: m61replay [-n PASSES] TRACE\n");
+    exit(1);
+}
+
+int main(int argc, char** argv) {
+    int passes = 1;
+    int opt;
+    while ((opt = getopt(argc, argv, "n:")) != -1) {
+        if (opt == 'n' && atoi(optarg) > 0) {
+            passes = atoi(optarg);
+        } else {
+            usage();
+        }
+    }
+    if (optind + 1 != argc) {
+        usage();
+    }
+
+    trace t;
+    if (!read_trace(argv[optind], t)) {
+        exit(1);
+    }
+    printf("%s: %zu events, %zu objects, %zu sites\n",
+           argv[optind], t.events.size(), (size_t) t.max_id, t.sites.size() - 1);
+    run<m61_heap>(t, passes);
+    run<system_heap>(t, passes);
+}
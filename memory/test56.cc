@@ -0,0 +1,61 @@
+#include "m61.hh"
+#include <cstdio>
+#include <cassert>
+#include <chrono>
+#include <random>
+// Compare first-fit and best-fit allocation throughput on a fragmented heap.
+
+static double churn(m61_fit_policy policy) {
+    m61_set_fit_policy(policy);
+    std::default_random_engine randomness(61);
+
+    // fragment the heap: lots of live blocks with small holes between
+    // them, so every bigger request has to get past the holes (sizes stay
+    // above the slab classes so this all happens in the general heap)
+    constexpr int nsmall = 12000;
+    static void* small[nsmall];
+    for (int i = 0; i != nsmall; ++i) {
+        small[i] = m61_malloc(256 + uniform_int(0, 255, randomness));
+        assert(small[i]);
+    }
+    for (int i = 0; i < nsmall; i += 2) {
+        m61_free(small[i]);
+        small[i] = nullptr;
+    }
+
+    // mixed-size churn over 200 slots, like test32
+    constexpr int nptrs = 200;
+    void* ptrs[nptrs] = {};
+    constexpr int nallocs = 5000;
+    auto start = std::chrono::steady_clock::now();
+    for (int i = 0; i != nallocs; ++i) {
+        void* ptr = m61_malloc(256 + uniform_int(0, 2047, randomness));
+        assert(ptr);
+        int slot = uniform_int(0, nptrs - 1, randomness);
+        m61_free(ptrs[slot]);
+        ptrs[slot] = ptr;
+    }
+    std::chrono::duration<double> elapsed = std::chrono::steady_clock::now() - start;
+
+    for (int i = 0; i != nptrs; ++i) {
+        m61_free(ptrs[i]);
+    }
+    for (int i = 0; i != nsmall; ++i) {
+        m61_free(small[i]);
+    }
+    return nallocs / elapsed.count();
+}
+
+int main() {
+    double first = churn(M61_FIRST_FIT);
+    double best = churn(M61_BEST_FIT);
+    printf("first-fit: %.0f allocations/sec\n", first);
+    printf("best-fit:  %.0f allocations/sec\n", best);
+    m61_print_statistics();
+}
+
+//!!TIME
+//! first-fit: ??? allocations/sec
+//! best-fit:  ??? allocations/sec
+//! alloc count: active          0   total      34000   fail          0
+//! alloc size:  active          0   total        ???   fail          0
@@ -0,0 +1,20 @@
+#include "m61.hh"
+#include <cstdio>
+#include <cassert>
+#include <cstring>
+// Check that invalid free inside a small (slab) block reports containing block.
+
+int main() {
+    void* ptr1 = m61_malloc(20);
+    void* ptr2 = m61_malloc(100);
+    void* ptr3 = m61_malloc(200);
+    m61_free((char*) ptr2 + 48);
+    m61_free(ptr1);
+    m61_free(ptr2);
+    m61_free(ptr3);
+    m61_print_statistics();
+}
+
+//! MEMORY BUG: test???.cc:11: invalid free of pointer ???, not allocated
+//!   test???.cc:9: ??? is 48 bytes inside a 100 byte region allocated here
+//! ???
@@ -0,0 +1,27 @@
+#include "m61.hh"
+#include <cstdio>
+#include <cassert>
+#include <vector>
+// Check that memory used for small objects goes back to the heap once freed.
+
+int main() {
+    // fill most of the heap with small objects of every size class
+    std::vector<void*> ptrs;
+    for (int i = 0; i != 50000; ++i) {
+        void* ptr = m61_malloc(1 + i % 255);
+        assert(ptr);
+        ptrs.push_back(ptr);
+    }
+    for (void* ptr : ptrs) {
+        m61_free(ptr);
+    }
+
+    // all of that space should be reusable for one big block
+    void* bigptr = m61_malloc(7 << 20);
+    assert(bigptr);
+    m61_free(bigptr);
+    m61_print_statistics();
+}
+
+//! alloc count: active          0   total      50001   fail          0
+//! alloc size:  active          0   total ??>=7340032??   fail          0
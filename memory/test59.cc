@@ -0,0 +1,78 @@
+#include "m61.hh"
+#include <cstdio>
+#include <cstdlib>
+#include <cstring>
+#include <cassert>
+#include <chrono>
+#include <random>
+#include <thread>
+#include <vector>
+#include <unistd.h>
+// Multithreaded stress: every thread churns small and big allocations,
+// checking that nobody else scribbled on its memory. Reports throughput for
+// 1, 2, and 4 threads, or only for `-j N` threads if given.
+
+constexpr int nallocs = 50000;
+
+static void churn(int id) {
+    std::default_random_engine randomness(61 + id);
+    constexpr int nptrs = 64;
+    unsigned char* ptrs[nptrs] = {};
+    size_t sizes[nptrs] = {};
+    for (int i = 0; i != nallocs; ++i) {
+        int slot = uniform_int(0, nptrs - 1, randomness);
+        if (ptrs[slot]) {
+            for (size_t j = 0; j != sizes[slot]; ++j) {
+                assert(ptrs[slot][j] == (unsigned char) (slot + id));
+            }
+            m61_free(ptrs[slot]);
+        }
+        // mostly small objects, sometimes a bigger one from the shared heap
+        sizes[slot] = i % 16 == 0 ? uniform_int(256, 4095, randomness)
+            : uniform_int(1, 255, randomness);
+        ptrs[slot] = (unsigned char*) m61_malloc(sizes[slot]);
+        assert(ptrs[slot]);
+        memset(ptrs[slot], slot + id, sizes[slot]);
+    }
+    for (int i = 0; i != nptrs; ++i) {
+        m61_free(ptrs[i]);
+    }
+}
+
+static double run(int nthreads) {
+    auto start = std::chrono::steady_clock::now();
+    std::vector<std::thread> threads;
+    for (int i = 0; i != nthreads; ++i) {
+        threads.emplace_back(churn, i);
+    }
+    for (auto& t : threads) {
+        t.join();
+    }
+    std::chrono::duration<double> elapsed = std::chrono::steady_clock::now() - start;
+    return nthreads * nallocs / elapsed.count();
+}
+
+int main(int argc, char** argv) {
+    std::vector<int> counts = {1, 2, 4};
+    int opt;
+    while ((opt = getopt(argc, argv, "j:")) != -1) {
+        if (opt == 'j') {
+            counts = {atoi(optarg)};
+        }
+    }
+    unsigned long long expected = 0;
+    for (int n : counts) {
+        printf("%d threads: %.0f allocations/sec\n", n, run(n));
+        expected += (unsigned long long) n * nallocs;
+    }
+    m61_statistics stats = m61_get_statistics();
+    assert(stats.ntotal == expected);
+    m61_print_statistics();
+}
+
+//!!TIME
+//! 1 threads: ??? allocations/sec
+//! 2 threads: ??? allocations/sec
+//! 4 threads: ??? allocations/sec
+//! alloc count: active          0   total     350000   fail          0
+//! alloc size:  active          0   total        ???   fail          0
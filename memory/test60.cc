@@ -0,0 +1,45 @@
+#include "m61.hh"
+#include <cstdio>
+#include <cassert>
+#include <cstring>
+// Check that the heap grows past one arena, that huge allocations get
+// their own mappings, and that bounds and leak reports cover all of it.
+
+int main() {
+    // 32 MiB of medium objects: more than one arena's worth
+    constexpr int n = 8192;
+    static char* ptrs[n];
+    for (int i = 0; i != n; ++i) {
+        ptrs[i] = (char*) m61_malloc(4000);
+        assert(ptrs[i]);
+        memset(ptrs[i], i & 255, 4000);
+    }
+    // bigger than any arena
+    char* huge = (char*) m61_malloc(20 << 20);
+    assert(huge);
+    memset(huge, 61, 20 << 20);
+
+    m61_statistics stat = m61_get_statistics();
+    for (int i = 0; i != n; ++i) {
+        assert(ptrs[i][3999] == (char) (i & 255));
+        assert((uintptr_t) ptrs[i] >= stat.heap_min);
+        assert((uintptr_t) ptrs[i] + 3999 <= stat.heap_max);
+    }
+    assert((uintptr_t) huge >= stat.heap_min);
+    assert((uintptr_t) huge + (20 << 20) - 1 <= stat.heap_max);
+
+    for (int i = 0; i != n - 1; ++i) {
+        m61_free(ptrs[i]);
+    }
+    printf("EXPECTED LEAK: %p with size 4000\n", ptrs[n - 1]);
+    printf("EXPECTED LEAK: %p with size %d\n", huge, 20 << 20);
+    m61_print_statistics();
+    m61_print_leak_report();
+}
+
+//! EXPECTED LEAK: ??{0x\w*}=ptr1?? with size 4000
+//! EXPECTED LEAK: ??{0x\w*}=ptr2?? with size 20971520
+//! alloc count: active          2   total       8193   fail          0
+//! alloc size:  active   20975520   total   53739520   fail          0
+//! LEAK CHECK: test???.cc:13: allocated object ??ptr1?? with size 4000
+//! LEAK CHECK: test???.cc:18: allocated object ??ptr2?? with size 20971520
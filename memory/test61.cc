@@ -0,0 +1,15 @@
+#include "m61.hh"
+#include <cstdio>
+#include <cassert>
+// Check invalid free inside a huge allocation.
+
+int main() {
+    char* huge = (char*) m61_malloc(2 << 20);
+    assert(huge);
+    m61_free(huge + 4096);
+    m61_print_statistics();
+}
+
+//! MEMORY BUG: test???.cc:9: invalid free of pointer ???, not allocated
+//! test???.cc:7: ??? is 4096 bytes inside a 2097152 byte region allocated here
+//! ???
@@ -0,0 +1,62 @@
+#include "m61.hh"
+#include <cstdio>
+#include <cassert>
+#include <cstring>
+#include <chrono>
+// Benchmark appending to a buffer through m61_realloc against always
+// copying into a fresh allocation, for small appends in the arenas and big
+// ones to a separately mapped block.
+
+struct result {
+    unsigned long long copied;
+    double seconds;
+};
+
+static result append(size_t start, size_t step, size_t end, bool use_realloc) {
+    unsigned long long copied = m61_get_statistics().realloc_copied;
+    auto t0 = std::chrono::steady_clock::now();
+    char* buf = (char*) m61_malloc(start);
+    memset(buf, 0, start);
+    for (size_t sz = start; sz + step <= end; sz += step) {
+        if (use_realloc) {
+            buf = (char*) m61_realloc(buf, sz + step);
+        } else {
+            char* nbuf = (char*) m61_malloc(sz + step);
+            memcpy(nbuf, buf, sz);
+            m61_free(buf);
+            buf = nbuf;
+            copied += sz;
+        }
+        assert(buf);
+        memset(buf + sz, (sz / step) & 255, step);
+    }
+    for (size_t sz = start; sz + step <= end; sz += step) {
+        assert(buf[sz] == (char) ((sz / step) & 255));
+    }
+    m61_free(buf);
+    std::chrono::duration<double> elapsed = std::chrono::steady_clock::now() - t0;
+    if (use_realloc) {
+        copied = m61_get_statistics().realloc_copied - copied;
+    }
+    return {copied, elapsed.count()};
+}
+
+int main() {
+    const struct { const char* name; size_t start, step, end; } runs[] = {
+        {"small appends", 1000, 1000, 1 << 20},
+        {"big appends", 1 << 20, 64 << 10, 8 << 20}
+    };
+    for (auto& run : runs) {
+        result copy = append(run.start, run.step, run.end, false);
+        result grow = append(run.start, run.step, run.end, true);
+        assert(grow.copied < copy.copied);
+        printf("%s, copy:    %llu bytes copied, %.3f sec\n", run.name, copy.copied, copy.seconds);
+        printf("%s, realloc: %llu bytes copied, %.3f sec\n", run.name, grow.copied, grow.seconds);
+    }
+}
+
+//!!TIME
+//! small appends, copy:    ??? bytes copied, ??? sec
+//! small appends, realloc: ??? bytes copied, ??? sec
+//! big appends, copy:    ??? bytes copied, ??? sec
+//! big appends, realloc: ??? bytes copied, ??? sec
@@ -0,0 +1,52 @@
+#include "m61.hh"
+#include <cstdio>
+#include <cassert>
+#include <cstring>
+#include <cstddef>
+#include <vector>
+// Check m61_arena: bulk allocation, reset, destroy, allocator, and leaks.
+
+int main() {
+    m61_arena* arena = m61_arena_create(4096);
+    char* ptrs[1000];
+    for (int i = 0; i != 1000; ++i) {
+        ptrs[i] = (char*) m61_arena_alloc(arena, 40);
+        assert(ptrs[i] && (uintptr_t) ptrs[i] % alignof(std::max_align_t) == 0);
+        memset(ptrs[i], i & 255, 40);
+    }
+    char* big = (char*) m61_arena_alloc(arena, 10000);
+    assert(big);
+    for (int i = 0; i != 1000; ++i) {
+        assert(ptrs[i][39] == (char) (i & 255));
+    }
+    m61_print_statistics();
+
+    // everything but the arena and one chunk goes back
+    m61_arena_reset(arena);
+    m61_print_statistics();
+
+    {
+        std::vector<int, m61_arena_allocator<int>> v{m61_arena_allocator<int>(arena)};
+        for (int i = 0; i != 1000; ++i) {
+            v.push_back(i);
+        }
+        assert(v[999] == 999);
+    }
+    m61_arena_destroy(arena);
+    m61_print_statistics();
+
+    m61_arena* leaked = m61_arena_create(4096);
+    void* ptr = m61_arena_alloc(leaked, 100);
+    assert(ptr);
+    m61_print_leak_report();
+}
+
+//! alloc count: active         14   total         14   fail          0
+//! alloc size:  active      59408   total      59408   fail          0
+//! alloc count: active          2   total         14   fail          0
+//! alloc size:  active       4160   total      59408   fail          0
+//! alloc count: active          0   total         16   fail          0
+//! alloc size:  active          0   total      65584   fail          0
+//! LEAK CHECK: test???.cc:38: allocated object ??{0x\w+}?? with size 48
+//! LEAK CHECK: test???.cc:38: allocated object ??{0x\w+}?? with size 4112
+//!!UNORDERED
@@ -0,0 +1,40 @@
+#include "m61.hh"
+#include <cstdio>
+#include <cassert>
+#include <cstring>
+// Check the per-site heap profile.
+
+static void* keep[200];
+
+int main() {
+    for (int i = 0; i != 100; ++i) {
+        keep[i] = m61_malloc(64);
+    }
+    for (int i = 0; i != 10; ++i) {
+        keep[100 + i] = m61_malloc(1000);
+    }
+    for (int i = 0; i != 5; ++i) {
+        m61_free(keep[100 + i]);
+    }
+    for (int i = 0; i != 3; ++i) {
+        m61_free(m61_malloc(300));
+    }
+    void* grown = m61_malloc(100);
+    grown = m61_realloc(grown, 20000);
+
+    bool found = false;
+    for (auto& st : m61_get_site_statistics()) {
+        if (st.line == 14) {
+            assert(st.live_count == 5 && st.total_count == 10);
+            assert(st.live_size == 5000 && st.peak_size == 10000);
+            found = true;
+        }
+    }
+    assert(found);
+    m61_print_heap_profile(4);
+}
+
+//! HEAP PROFILE: test???.cc:23: 20000 bytes live in 1 objects, peak 20000, 1 allocations
+//! HEAP PROFILE: test???.cc:11: 6400 bytes live in 100 objects, peak 6400, 100 allocations
+//! HEAP PROFILE: test???.cc:14: 5000 bytes live in 5 objects, peak 10000, 10 allocations
+//! HEAP PROFILE: test???.cc:20: 0 bytes live in 0 objects, peak 300, 3 allocations
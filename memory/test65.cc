@@ -0,0 +1,48 @@
+#include "m61.hh"
+#include <cstdio>
+#include <cassert>
+#include <cstring>
+#include <vector>
+// Check m61_free_sized, m61_malloc_batch, m61_free_batch, and the sized
+// path through m61_allocator.
+
+int main() {
+    const size_t sizes[] = {24, 1000, 2 << 20};
+    for (size_t sz : sizes) {
+        void* ptrs[100];
+        size_t n = m61_malloc_batch(100, sz, ptrs);
+        assert(n == 100);
+        for (int i = 0; i != 100; ++i) {
+            memset(ptrs[i], i, sz);
+        }
+        for (int i = 0; i != 100; ++i) {
+            assert(((unsigned char*) ptrs[i])[sz - 1] == i);
+        }
+        // free half one at a time with their sizes, the rest as a batch
+        for (int i = 0; i < 100; i += 2) {
+            m61_free_sized(ptrs[i], sz);
+            ptrs[i] = nullptr;
+        }
+        m61_free_batch(100, ptrs);
+    }
+
+    // a batch big enough to empty (and give back) slab pages, with a
+    // block after the slab objects
+    std::vector<void*> batch;
+    for (int i = 0; i != 400; ++i) {
+        batch.push_back(m61_malloc(16));
+    }
+    batch.push_back(m61_malloc(1000));
+    m61_free_batch(batch.size(), batch.data());
+
+    std::vector<int, m61_allocator<int>> v;
+    for (int i = 0; i != 10000; ++i) {
+        v.push_back(i);
+    }
+    v.clear();
+    v.shrink_to_fit();
+    m61_print_statistics();
+}
+
+//! alloc count: active          0   total        ???   fail          0
+//! alloc size:  active          0   total        ???   fail          0
@@ -0,0 +1,13 @@
+#include "m61.hh"
+#include <cstdio>
+#include <cassert>
+// Check that m61_free_sized catches a wrong size.
+
+int main() {
+    void* ptr = m61_malloc(100);
+    m61_free_sized(ptr, 120);
+    m61_print_statistics();
+}
+
+//! MEMORY BUG: test???.cc:8: invalid free of pointer ??? with size 120, allocated with size 100
+//! ???
@@ -0,0 +1,33 @@
+#include "m61.hh"
+#include <cstdio>
+#include <cassert>
+#include <cstring>
+// Check that freed memory goes back to the OS and the statistics say so.
+
+int main() {
+    m61_statistics before = m61_get_statistics();
+    constexpr int n = 6000;
+    static char* ptrs[n];
+    for (int i = 0; i != n; ++i) {
+        ptrs[i] = (char*) m61_malloc(1000);
+        assert(ptrs[i]);
+        memset(ptrs[i], 1, 1000);
+    }
+    m61_statistics during = m61_get_statistics();
+    for (int i = 0; i != n; ++i) {
+        m61_free(ptrs[i]);
+    }
+    m61_statistics after = m61_get_statistics();
+
+    assert(during.heap_mapped == before.heap_mapped);
+    printf("resident grows by >= 5 MiB: %s\n",
+           during.heap_resident - before.heap_resident >= (5 << 20) ? "yes" : "no");
+    printf("resident shrinks back to < 128 KiB above start: %s\n",
+           after.heap_resident - before.heap_resident < (128 << 10) ? "yes" : "no");
+    m61_print_statistics();
+}
+
+//! resident grows by >= 5 MiB: yes
+//! resident shrinks back to < 128 KiB above start: yes
+//! alloc count: active          0   total       6000   fail          0
+//! alloc size:  active          0   total    6000000   fail          0
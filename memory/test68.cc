@@ -0,0 +1,62 @@
+#include "m61.hh"
+#include <cstdio>
+#include <cassert>
+#include <cstring>
+#include <chrono>
+// Benchmark m61_calloc, which only clears memory that may have been used,
+// against m61_malloc + memset, on 256 KiB blocks that are freed (and given
+// back to the OS) between rounds. Also checks calloc memory is zero even
+// when it reuses dirty memory.
+
+constexpr size_t size = 256 << 10;
+constexpr int nblocks = 16;
+constexpr int rounds = 100;
+
+static double run(bool use_calloc) {
+    char* ptrs[nblocks];
+    auto start = std::chrono::steady_clock::now();
+    for (int r = 0; r != rounds; ++r) {
+        for (int i = 0; i != nblocks; ++i) {
+            if (use_calloc) {
+                ptrs[i] = (char*) m61_calloc(1, size);
+            } else {
+                ptrs[i] = (char*) m61_malloc(size);
+                memset(ptrs[i], 0, size);
+            }
+            assert(ptrs[i]);
+        }
+        for (int i = 0; i != nblocks; ++i) {
+            m61_free(ptrs[i]);
+        }
+    }
+    std::chrono::duration<double> elapsed = std::chrono::steady_clock::now() - start;
+    return elapsed.count();
+}
+
+int main() {
+    // dirty memory, half of it freed without being released
+    char* dirty[64];
+    for (int i = 0; i != 64; ++i) {
+        dirty[i] = (char*) m61_malloc(10000);
+        memset(dirty[i], 61, 10000);
+    }
+    for (int i = 0; i < 64; i += 2) {
+        m61_free(dirty[i]);
+    }
+    for (int i = 0; i != 32; ++i) {
+        unsigned char* p = (unsigned char*) m61_calloc(100, 90);
+        for (int j = 0; j != 9000; ++j) {
+            assert(p[j] == 0);
+        }
+    }
+
+    double t_memset = run(false);
+    double t_calloc = run(true);
+    double mib = double(size) * nblocks * rounds / (1 << 20);
+    printf("malloc+memset: %.0f MiB/sec\n", mib / t_memset);
+    printf("calloc:        %.0f MiB/sec\n", mib / t_calloc);
+}
+
+//!!TIME
+//! malloc+memset: ??? MiB/sec
+//! calloc:        ??? MiB/sec
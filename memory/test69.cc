@@ -0,0 +1,70 @@
+#include "m61.hh"
+#include <cstdio>
+#include <cstdlib>
+#include <cstring>
+#include <cassert>
+#include <algorithm>
+#include <chrono>
+#include <random>
+#include <unistd.h>
+#include <sys/wait.h>
+// Benchmark random pointer chasing through many small objects with the heap
+// on normal pages and (if the system has them) on huge pages. Each mode runs
+// in a fresh copy of this program, since the backing is chosen at startup.
+
+struct node {
+    node* next;
+    long payload[5];
+};
+
+static void chase() {
+    constexpr int n = 100000;
+    static node* nodes[n];
+    for (int i = 0; i != n; ++i) {
+        nodes[i] = (node*) m61_malloc(sizeof(node));
+        assert(nodes[i]);
+    }
+    // link them into one cycle in random order
+    std::default_random_engine randomness(61);
+    std::shuffle(nodes, nodes + n, randomness);
+    for (int i = 0; i != n; ++i) {
+        nodes[i]->next = nodes[(i + 1) % n];
+    }
+
+    constexpr long steps = 10000000;
+    auto start = std::chrono::steady_clock::now();
+    node* p = nodes[0];
+    for (long i = 0; i != steps; ++i) {
+        p = p->next;
+    }
+    std::chrono::duration<double> elapsed = std::chrono::steady_clock::now() - start;
+    assert(p);
+
+    static const char* const names[] = {"normal", "transparent huge", "hugetlb", "mixed"};
+    m61_statistics stats = m61_get_statistics();
+    printf("%s pages: %.1f ns/access\n", names[stats.heap_backing], elapsed.count() * 1e9 / steps);
+}
+
+int main(int argc, char** argv) {
+    if (argc > 1 && strcmp(argv[1], "-c") == 0) {
+        chase();
+        return 0;
+    }
+    for (const char* mode : {"0", "1"}) {
+        fflush(stdout);
+        pid_t p = fork();
+        assert(p >= 0);
+        if (p == 0) {
+            setenv("M61_HUGEPAGES", mode, 1);
+            execl(argv[0], argv[0], "-c", nullptr);
+            _exit(1);
+        }
+        int status;
+        waitpid(p, &status, 0);
+        assert(WIFEXITED(status) && WEXITSTATUS(status) == 0);
+    }
+}
+
+//!!TIME
+//! normal pages: ??? ns/access
+//! ??? pages: ??? ns/access
@@ -0,0 +1,79 @@
+#include "m61.hh"
+#include <cstdio>
+#include <cassert>
+#include <cerrno>
+#include <cstring>
+#include <vector>
+// Check m61_aligned_alloc, m61_posix_memalign, and m61_aligned_allocator:
+// results are aligned, free/realloc/leak reports treat them like any other
+// allocation, and alignment costs no more than the alignment itself.
+
+struct alignas(64) cache_line {
+    char bytes[64];
+};
+
+int main() {
+    for (size_t align = 32; align <= 4096; align *= 2) {
+        for (size_t sz : {1, 100, 3000}) {
+            char* p = (char*) m61_aligned_alloc(align, sz);
+            assert(p && (uintptr_t) p % align == 0);
+            memset(p, 61, sz);
+            m61_free(p);
+        }
+    }
+
+    // the padding in front of an aligned block goes back to the heap, so
+    // many of them fit in the first arena
+    m61_statistics before = m61_get_statistics();
+    static void* ptrs[10000];
+    for (int i = 0; i != 10000; ++i) {
+        ptrs[i] = m61_aligned_alloc(256, 256);
+        assert(ptrs[i] && (uintptr_t) ptrs[i] % 256 == 0);
+    }
+    assert(m61_get_statistics().heap_mapped == before.heap_mapped);
+    for (int i = 0; i != 10000; ++i) {
+        m61_free_sized(ptrs[i], 256);
+    }
+
+    // big aligned blocks map just the pages holding header, payload and canary
+    before = m61_get_statistics();
+    char* big = (char*) m61_aligned_alloc(2 << 20, 3 << 20);
+    assert(big && (uintptr_t) big % (2 << 20) == 0);
+    memset(big, 61, 3 << 20);
+    assert(m61_get_statistics().heap_mapped - before.heap_mapped == (3 << 20) + 2 * 4096);
+    big = (char*) m61_realloc(big, 5 << 20);
+    assert(big && big[(3 << 20) - 1] == 61);
+    m61_free(big);
+
+    // realloc keeps the contents (alignment is only promised by aligned_alloc)
+    char* p = (char*) m61_aligned_alloc(128, 200);
+    memset(p, 7, 200);
+    p = (char*) m61_realloc(p, 5000);
+    assert(p[199] == 7);
+    m61_free(p);
+
+    void* q = nullptr;
+    assert(m61_posix_memalign(&q, 24, 10) == EINVAL && !q);
+    assert(m61_posix_memalign(&q, 4, 10) == EINVAL && !q);
+    assert(m61_posix_memalign(&q, 0, 10) == EINVAL && !q);
+    assert(m61_posix_memalign(&q, 512, 10) == 0 && (uintptr_t) q % 512 == 0);
+    assert(!m61_aligned_alloc(48, 10));
+
+    std::vector<cache_line, m61_aligned_allocator<cache_line>> v(1000);
+    for (auto& c : v) {
+        assert((uintptr_t) &c % 64 == 0);
+    }
+    v.clear();
+    v.shrink_to_fit();
+
+    void* leak = m61_aligned_alloc(1024, 10);
+    printf("EXPECTED LEAK: %p with size 10\n", q);
+    printf("EXPECTED LEAK: %p with size 10\n", leak);
+    m61_print_leak_report();
+}
+
+//! EXPECTED LEAK: ??{0x\w*}=ptr1?? with size 10
+//! EXPECTED LEAK: ??{0x\w*}=ptr2?? with size 10
+//!!UNORDERED
+//! LEAK CHECK: test???.cc:59: allocated object ??ptr1?? with size 10
+//! LEAK CHECK: test???.cc:69: allocated object ??ptr2?? with size 10
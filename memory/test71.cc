@@ -0,0 +1,42 @@
+#include "m61.hh"
+#include <cstdio>
+#include <cassert>
+// Check the extended statistics: live size histogram, peak, and free
+// block counts that notice fragmentation.
+
+int main() {
+    void* small[10];
+    void* medium[5];
+    for (int i = 0; i != 10; ++i) {
+        small[i] = m61_malloc(100);
+    }
+    for (int i = 0; i != 5; ++i) {
+        medium[i] = m61_malloc(5000);
+    }
+    m61_extended_statistics before = m61_get_extended_statistics();
+    assert(before.size_histogram[7] == 10);
+    assert(before.size_histogram[13] == 5);
+
+    // free every other medium block: holes that can't merge
+    for (int i = 0; i != 10; i += 2) {
+        m61_free(small[i]);
+    }
+    m61_free(medium[1]);
+    m61_free(medium[3]);
+    m61_extended_statistics after = m61_get_extended_statistics();
+    assert(after.nfree_blocks == before.nfree_blocks + 2);
+    assert(after.largest_free_block == before.largest_free_block);
+    assert(after.fragmentation > before.fragmentation);
+
+    // growing in place moves an object to another bucket
+    medium[0] = m61_realloc(medium[0], 9000);
+    m61_print_statistics(true);
+}
+
+//! alloc count: active          8   total         15   fail          0
+//! alloc size:  active      19500   total      26000   fail          0
+//! alloc peak:  active      26000
+//! free blocks: count  ???   size  ???   largest ???   fragmentation 0.???
+//! alloc sizes:         64 -        127   active          5
+//! alloc sizes:       4096 -       8191   active          2
+//! alloc sizes:       8192 -      16383   active          1
@@ -0,0 +1,18 @@
+#include "m61.hh"
+#include <cstdio>
+#include <cassert>
+#include <cstring>
+// With every allocation sampled, an overflow faults on the guard page
+// right away, long before the free.
+
+int main() {
+    m61_set_sample_rate(1);
+    char* ptr = (char*) m61_malloc(32);
+    memset(ptr, 0, 32);
+    ptr[32] = 1;
+    m61_free(ptr);
+    m61_print_statistics();
+}
+
+//! MEMORY BUG: test???.cc:10: invalid ??{write to|access to}?? ??{0x\w+}??, 0 bytes past the end of a 32 byte region allocated here
+//! ???
@@ -0,0 +1,20 @@
+#include "m61.hh"
+#include <cstdio>
+#include <cassert>
+#include <cstring>
+// With every allocation sampled, reading freed memory faults.
+
+int main() {
+    m61_set_sample_rate(1);
+    int* ptr = (int*) m61_malloc(sizeof(int) * 10);
+    for (int i = 0; i != 10; ++i) {
+        ptr[i] = i;
+    }
+    m61_free(ptr);
+    printf("%d\n", ptr[4]);
+    m61_print_statistics();
+}
+
+//! MEMORY BUG: test???.cc:13: invalid ??{read of|access to}?? ??{0x\w+}?? after free, 16 bytes into a 40 byte region freed here
+//! test???.cc:9: the region was allocated here
+//! ???
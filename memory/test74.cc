@@ -0,0 +1,35 @@
+#include "m61.hh"
+#include <cstdio>
+#include <cassert>
+#include <cstring>
+// Sampled allocations behave like any others: they are aligned, can be
+// reallocated and freed in any order, and appear in statistics and leak
+// reports. Once the guarded pool is full, allocations go to the heap.
+
+int main() {
+    m61_set_sample_rate(1);
+    static char* ptrs[1000];
+    for (int i = 0; i != 1000; ++i) {
+        size_t sz = (i * 37) % 4097;
+        ptrs[i] = (char*) m61_malloc(sz);
+        assert(ptrs[i] && (uintptr_t) ptrs[i] % 16 == 0);
+        memset(ptrs[i], i, sz);
+    }
+    for (int i = 0; i < 1000; i += 2) {
+        ptrs[i] = (char*) m61_realloc(ptrs[i], 100);
+        assert(ptrs[i][0] == (char) i || (i * 37) % 4097 == 0);
+    }
+    for (int i = 0; i != 999; ++i) {
+        m61_free(ptrs[i]);
+    }
+    m61_set_sample_rate(0);
+
+    printf("EXPECTED LEAK: %p with size %d\n", ptrs[999], (999 * 37) % 4097);
+    m61_print_statistics();
+    m61_print_leak_report();
+}
+
+//! EXPECTED LEAK: ??{0x\w+}=ptr?? with size 90
+//! alloc count: active          1   total       1137   fail          0
+//! alloc size:  active         90   total        ???   fail          0
+//! LEAK CHECK: test???.cc:14: allocated object ??ptr?? with size 90
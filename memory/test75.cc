@@ -0,0 +1,94 @@
+#include "m61.hh"
+#include <cstdio>
+#include <cassert>
+#include <chrono>
+#include <unistd.h>
+#include <sys/wait.h>
+// Benchmark walking linked lists that were built at the same time, one
+// allocation site per list, with best-fit placement and with site-aware
+// placement (which keeps each site's nodes together). Each policy runs in
+// a fresh child process.
+
+struct small_node {
+    small_node* next;
+    long value[3];
+};
+
+struct large_node {
+    large_node* next;
+    long value[40];
+};
+
+constexpr int nlists = 8;
+
+template <typename Node>
+static double walk(int n) {
+    // build the lists round-robin, one node per list at a time
+    Node* heads[nlists] = {};
+    Node** tails[nlists];
+    for (int k = 0; k != nlists; ++k) {
+        tails[k] = &heads[k];
+    }
+    for (int i = 0; i != n; ++i) {
+        for (int k = 0; k != nlists; ++k) {
+            // each list is its own site
+            Node* node = (Node*) m61_malloc(sizeof(Node), __FILE__, 1000 + k);
+            assert(node);
+            node->next = nullptr;
+            node->value[0] = i;
+            *tails[k] = node;
+            tails[k] = &node->next;
+        }
+    }
+
+    constexpr int passes = 10;
+    long sum = 0;
+    auto start = std::chrono::steady_clock::now();
+    for (int pass = 0; pass != passes; ++pass) {
+        for (int k = 0; k != nlists; ++k) {
+            for (Node* node = heads[k]; node; node = node->next) {
+                sum += node->value[0];
+            }
+        }
+    }
+    std::chrono::duration<double> elapsed = std::chrono::steady_clock::now() - start;
+    assert(sum == (long) passes * nlists * n * (n - 1) / 2);
+
+    for (int k = 0; k != nlists; ++k) {
+        while (Node* node = heads[k]) {
+            heads[k] = node->next;
+            m61_free(node);
+        }
+    }
+    return elapsed.count() * 1e9 / ((double) passes * nlists * n);
+}
+
+static void run(m61_fit_policy policy, const char* name) {
+    fflush(stdout);
+    pid_t p = fork();
+    assert(p >= 0);
+    if (p == 0) {
+        m61_set_fit_policy(policy);
+        double small = walk<small_node>(100000);
+        double large = walk<large_node>(20000);
+        printf("%s small nodes %.2f ns/node, large nodes %.2f ns/node\n", name, small, large);
+        m61_print_statistics();
+        exit(0);
+    }
+    int status;
+    waitpid(p, &status, 0);
+    assert(WIFEXITED(status) && WEXITSTATUS(status) == 0);
+}
+
+int main() {
+    run(M61_BEST_FIT, "best-fit:");
+    run(M61_SITE_FIT, "site-fit:");
+}
+
+//!!TIME
+//! best-fit: small nodes ??? ns/node, large nodes ??? ns/node
+//! alloc count: active          0   total     960000   fail          0
+//! alloc size:  active          0   total        ???   fail          0
+//! site-fit: small nodes ??? ns/node, large nodes ??? ns/node
+//! alloc count: active          0   total     960000   fail          0
+//! alloc size:  active          0   total        ???   fail          0
@@ -0,0 +1,118 @@
+#include "m61.hh"
+#include <cstdio>
+#include <cstdlib>
+#include <cstring>
+#include <cassert>
+#include <chrono>
+#include <string>
+#include <unistd.h>
+#include <sys/wait.h>
+// Benchmark starting up with an index kept in a persistent heap
+// (M61_HEAP_FILE): the first run builds the index, the second finds it
+// through m61_get_root, checks it, and frees most of it. Each run is a fresh
+// copy of this program, timed from just before it starts.
+
+struct entry {
+    entry* next;
+    unsigned key;
+    unsigned value;
+    char name[24];
+};
+
+struct hash_index {
+    size_t nbuckets;
+    size_t n;
+    entry** buckets;
+};
+
+constexpr unsigned nentries = 200000;
+constexpr size_t nbuckets = 65536;
+
+static void ready(const char* what, long long start_ns) {
+    long long now = std::chrono::steady_clock::now().time_since_epoch().count();
+    printf("%s: ready after %.1f ms\n", what, (now - start_ns) / 1e6);
+}
+
+static void build(long long start_ns) {
+    assert(!m61_get_root());
+    hash_index* ix = (hash_index*) m61_malloc(sizeof(hash_index));
+    ix->nbuckets = nbuckets;
+    ix->n = 0;
+    ix->buckets = (entry**) m61_calloc(nbuckets, sizeof(entry*));
+    for (unsigned k = 0; k != nentries; ++k) {
+        entry* e = (entry*) m61_malloc(sizeof(entry));
+        assert(e);
+        e->key = k;
+        e->value = k * 61;
+        snprintf(e->name, sizeof(e->name), "key%u", k);
+        e->next = ix->buckets[k % nbuckets];
+        ix->buckets[k % nbuckets] = e;
+        ++ix->n;
+    }
+    m61_set_root(ix);
+    ready("build", start_ns);
+    m61_print_statistics();
+}
+
+static void reopen(long long start_ns) {
+    hash_index* ix = (hash_index*) m61_get_root();
+    assert(ix && ix->n == nentries);
+    ready("reopen", start_ns);
+    m61_print_statistics();
+
+    for (unsigned k = 0; k != nentries; ++k) {
+        entry* e = ix->buckets[k % nbuckets];
+        while (e && e->key != k) {
+            e = e->next;
+        }
+        char name[24];
+        snprintf(name, sizeof(name), "key%u", k);
+        assert(e && e->value == k * 61 && strcmp(e->name, name) == 0);
+    }
+    for (size_t b = 0; b != ix->nbuckets; ++b) {
+        while (entry* e = ix->buckets[b]) {
+            ix->buckets[b] = e->next;
+            m61_free(e);
+        }
+    }
+    m61_free(ix->buckets);
+    m61_print_leak_report();
+}
+
+int main(int argc, char** argv) {
+    if (argc > 2 && strcmp(argv[1], "-b") == 0) {
+        build(strtoll(argv[2], nullptr, 0));
+        return 0;
+    } else if (argc > 2 && strcmp(argv[1], "-r") == 0) {
+        reopen(strtoll(argv[2], nullptr, 0));
+        return 0;
+    }
+    char path[] = "/tmp/test76.heap.XXXXXX";
+    int fd = mkstemp(path);
+    assert(fd >= 0);
+    close(fd);
+    for (const char* mode : {"-b", "-r"}) {
+        fflush(stdout);
+        std::string start = std::to_string(std::chrono::steady_clock::now().time_since_epoch().count());
+        pid_t p = fork();
+        assert(p >= 0);
+        if (p == 0) {
+            setenv("M61_HEAP_FILE", path, 1);
+            execl(argv[0], argv[0], mode, start.c_str(), nullptr);
+            _exit(1);
+        }
+        int status;
+        waitpid(p, &status, 0);
+        assert(WIFEXITED(status) && WEXITSTATUS(status) == 0);
+    }
+    unlink(path);
+}
+
+//!!TIME
+//! build: ready after ??? ms
+//! alloc count: active     200002   total     200002   fail          0
+//! alloc size:  active    8524312   total    8524312   fail          0
+//! reopen: ready after ??? ms
+//! alloc count: active     200002   total     200002   fail          0
+//! alloc size:  active    8524312   total    8524312   fail          0
+//! LEAK CHECK: test76.cc:38: allocated object ??{0x\w*}?? with size 24
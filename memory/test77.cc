@@ -0,0 +1,24 @@
+#include "m61.hh"
+#include <cstdio>
+#include <cstring>
+// With the heap scanner on, an overflow into a live object's red zone is
+// found while the program runs, even 8 bytes past a 15-byte object (its
+// red zone is at least 16 bytes), and even though the object is never freed.
+
+int main() {
+    m61_set_scan_interval(10);
+    char* keep[100];
+    for (int i = 0; i != 100; ++i) {
+        keep[i] = (char*) m61_malloc(100 + i);
+    }
+    char* ptr = (char*) m61_malloc(15);
+    ptr[23] = 1;
+    for (int i = 0; i != 100000; ++i) {
+        m61_free(m61_malloc(1000));
+    }
+    printf("overflow not found\n");
+    (void) keep;
+}
+
+//! MEMORY BUG: test???.cc:14: detected wild write past the end of pointer ??{0x\w+}??, a 15 byte region allocated here
+//! ???
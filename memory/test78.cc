@@ -0,0 +1,37 @@
+#include "m61.hh"
+#include <cstdio>
+#include <cstring>
+#include <vector>
+// m61_check_heap passes a healthy heap, and reports a write that skips
+// over an object's red zone and lands on the next block's header.
+
+int main() {
+    std::default_random_engine randomness(78);
+    std::vector<char*> ptrs;
+    for (int i = 0; i != 20000; ++i) {
+        if (ptrs.empty() || uniform_int(0, 2, randomness) != 0) {
+            size_t sz = uniform_int(0, 3, randomness) == 0 ? uniform_int(0, 20000, randomness)
+                                                           : uniform_int(0, 300, randomness);
+            ptrs.push_back((char*) m61_malloc(sz));
+            memset(ptrs.back(), 'a', sz);
+        } else {
+            size_t j = uniform_int(size_t(0), ptrs.size() - 1, randomness);
+            ptrs[j] = (char*) m61_realloc(ptrs[j], uniform_int(1, 3000, randomness));
+        }
+    }
+    ptrs.push_back((char*) m61_malloc(2 << 20));
+    m61_check_heap();
+    printf("heap ok\n");
+
+    // shrinking a block in place leaves a free block right behind it
+    char* ptr = (char*) m61_malloc(2000);
+    ptr = (char*) m61_realloc(ptr, 1000);
+    memset(ptr + 1024, 0, 8);
+    m61_check_heap();
+    printf("damage not found\n");
+}
+
+//! heap ok
+//! MEMORY BUG: detected wild write over heap metadata at ??{0x\w+}??
+//! test???.cc:27: ??{0x\w+}?? is 24 bytes past the end of a 1000 byte region allocated here
+//! ???
@@ -0,0 +1,23 @@
+#include "m61.hh"
+#include <cstdio>
+#include <cassert>
+#include <cstdint>
+#include <unistd.h>
+// A fault on a guard page with no live sampled object on either side,
+// here the pool's last guard page, is reported as a wild access.
+
+int main() {
+    m61_set_sample_rate(1);
+    char* ptr = (char*) m61_malloc(32);
+    assert(ptr);
+    // the pool is [guard][slot 0][guard]...[slot 255][guard], and the
+    // first sample takes slot 0
+    uintptr_t page = sysconf(_SC_PAGESIZE);
+    char* pool = (char*) ((uintptr_t) ptr / page * page - page);
+    m61_free(ptr);
+    volatile char* last_guard = pool + 2 * 256 * page;
+    printf("%d\n", *last_guard);
+}
+
+//! MEMORY BUG: invalid ??{read of|access to}?? ??{0x\w+}??, a wild pointer into a guard page
+//! ???